@@ -18,6 +18,13 @@ struct Config config = {
 	/* whether to ignore requests from indirect sources, accept only direct requests */
 	.ignoreindirect = 0,
 
+	/* whether to move windows of hidden desktops off screen rather than unmapping them */
+	.parkdesktops = 0,
+
+	/* resizing with the mouse */
+	.liveresize = 0,        /* whether to resize windows while dragging rather than drawing an outline */
+	.resizerate = 60,       /* maximum resizes per second of windows not supporting _NET_WM_SYNC_REQUEST */
+
 	/* mouse control (these configuration cannot be set via X resources) */
 	.modifier = Mod1Mask,   /* modifier pressed with mouse button */
 	.focusbuttons = 1,      /* bit mask of mouse buttons that focus windows */
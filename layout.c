@@ -0,0 +1,379 @@
+#include <err.h>
+#include <limits.h>
+#include <stdlib.h>
+#include "layout.h"
+
+/* get maximum */
+static int
+max(int x, int y)
+{
+	return x > y ? x : y;
+}
+
+/* get minimum */
+static int
+min(int x, int y)
+{
+	return x < y ? x : y;
+}
+
+/* compute geometry of tiled windows, columns and rows */
+void
+layouttile(struct Tilecol *cols, int ncols, const struct Tileconf *conf)
+{
+	struct Tilecol *col;
+	struct Tile *tile;
+	int recol = 0, rerow = 0;       /* whether to resize columns and rows */
+	int sumw, sumh;
+	int nrows, nshaded;
+	int x, y, w, h;
+	int b, g, t;
+	int i, j;
+
+	if (ncols == 0)
+		return;
+	b = conf->b;
+	g = conf->g;
+	t = conf->t;
+
+	/* sum widths of columns with borders and gaps applied */
+	sumw = 0;
+	for (i = 0; i < ncols; i++)
+		sumw += cols[i].w + b * 2;
+	sumw += g * (ncols - 1);
+
+	/* decide whether to recalculate columns widths */
+	recol = (sumw != conf->area.w);
+
+	w = (conf->area.w - g * (ncols - 1) - b * 2 * ncols) / ncols;
+	x = conf->area.x;
+	for (i = 0; i < ncols; i++) {
+		col = &cols[i];
+		nrows = col->ntiles;
+
+		/* the last column gets the remaining width */
+		if (i == ncols - 1)
+			w = conf->area.w + conf->area.x - x - 2 * b;
+
+		/* sum heights of windows in current column */
+		sumh = 0;
+		for (nshaded = j = 0; j < nrows; j++) {
+			sumh += col->tiles[j].ch + b * 2 + t;
+			if (col->tiles[j].isshaded)
+				nshaded++;
+		}
+		sumh += g * (nrows - 1);
+
+		/* decide whether to recalculate window heights */
+		rerow = (sumh != conf->area.h);
+
+		if (nshaded < nrows)
+			h = (conf->area.h - g * (nrows - 1) - b * 2 * nrows - t * nrows) / (nrows - nshaded);
+		else
+			h = 0;
+		y = conf->area.y;
+
+		for (j = 0; j < nrows; j++) {
+			tile = &col->tiles[j];
+			if (tile->isfullscreen)
+				continue;
+
+			/* the last window gets the remaining height */
+			if (j == nrows - 1)
+				h = conf->area.h + conf->area.y - y - t - 2 * b;
+
+			/* set new width and heights */
+			if (recol || i == ncols - 1)
+				col->w = w;
+			if (rerow || j == nrows - 1)
+				tile->h = h;
+
+			/* if there is only one tiled window, borders or gaps can be ignored */
+			tile->b = b;
+			if (!tile->isshaded)
+				tile->t = t;
+			if (nrows == 1 && ncols == 1) {
+				if (conf->ignoreborders) {
+					col->w += 2 * b;
+					tile->h += 2 * b;
+					tile->b = 0;
+				}
+				if (conf->ignoregaps) {
+					x = conf->full.x;
+					y = conf->full.y;
+					col->w = conf->full.w - ((!conf->ignoreborders) ? 2 * b : 0);
+					tile->h = conf->full.h - ((!conf->ignoreborders) ? 2 * b : 0) - t;
+				}
+				if (conf->ignoretitle && !tile->isshaded && tile->issingletab) {
+					tile->t = 0;
+					tile->h += t;
+				}
+			}
+
+			if (tile->isshaded)
+				tile->h = 0;
+
+			tile->x = x + tile->b;
+			tile->y = y + tile->b + tile->t;
+			tile->w = col->w;
+
+			y += tile->h + g + b * 2 + t;
+		}
+
+		x += col->w + g + b * 2;
+	}
+}
+
+/* compare two integers, for qsort(3) */
+static int
+intcmp(const void *a, const void *b)
+{
+	return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+/* sort edges and remove duplicates, returning their new number */
+static int
+edgesort(int *edges, int n)
+{
+	int i, j;
+
+	qsort(edges, n, sizeof *edges, intcmp);
+	for (i = j = 0; i < n; i++)
+		if (j == 0 || edges[j - 1] != edges[i])
+			edges[j++] = edges[i];
+	return j;
+}
+
+/* get index of edge e, which must be in the sorted edges */
+static int
+edgeindex(const int *edges, int n, int e)
+{
+	const int *p;
+
+	p = bsearch(&e, edges, n, sizeof *edges, intcmp);
+	return p - edges;
+}
+
+/*
+ * Find the largest rectangle of area overlapped by the fewest windows.
+ * The window edges split the area into cells, whose window counts are
+ * summed into a table and swept row by row as a histogram; the cost
+ * depends on the number of windows only, not on the size of the area.
+ */
+struct Rect
+layoutplace(const struct Rect *area, const struct Rect *wins, int nwins)
+{
+	struct Rect sub, r;
+	long long best, a;
+	int *xs, *ys, *sum, *hist, *stack;
+	int nx, ny, x0, x1, y0, y1;
+	int lowest, top, left;
+	int i, j, k, m;
+
+	sub = *area;
+	if (area->w <= 0 || area->h <= 0)
+		return sub;
+	m = 2 * nwins + 2;       /* maximum number of edges in each axis */
+	if ((xs = calloc(4 * m + m * m, sizeof *xs)) == NULL)
+		err(1, "calloc");
+	ys = xs + m;
+	hist = ys + m;
+	stack = hist + m;
+	sum = stack + m;
+
+	/* get the edges of the windows, clipped to the area */
+	nx = ny = 0;
+	xs[nx++] = area->x;
+	xs[nx++] = area->x + area->w;
+	ys[ny++] = area->y;
+	ys[ny++] = area->y + area->h;
+	for (k = 0; k < nwins; k++) {
+		xs[nx++] = max(area->x, min(area->x + area->w, wins[k].x));
+		xs[nx++] = max(area->x, min(area->x + area->w, wins[k].x + wins[k].w));
+		ys[ny++] = max(area->y, min(area->y + area->h, wins[k].y));
+		ys[ny++] = max(area->y, min(area->y + area->h, wins[k].y + wins[k].h));
+	}
+	nx = edgesort(xs, nx);
+	ny = edgesort(ys, ny);
+
+	/* mark the corners of each window, then sum them into the number of windows over each cell */
+	for (k = 0; k < nwins; k++) {
+		x0 = edgeindex(xs, nx, max(area->x, min(area->x + area->w, wins[k].x)));
+		x1 = edgeindex(xs, nx, max(area->x, min(area->x + area->w, wins[k].x + wins[k].w)));
+		y0 = edgeindex(ys, ny, max(area->y, min(area->y + area->h, wins[k].y)));
+		y1 = edgeindex(ys, ny, max(area->y, min(area->y + area->h, wins[k].y + wins[k].h)));
+		if (x0 >= x1 || y0 >= y1)
+			continue;
+		sum[y0 * nx + x0]++;
+		sum[y0 * nx + x1]--;
+		sum[y1 * nx + x0]--;
+		sum[y1 * nx + x1]++;
+	}
+	lowest = INT_MAX;
+	for (i = 0; i < ny - 1; i++) {
+		for (j = 0; j < nx - 1; j++) {
+			if (i > 0)
+				sum[i * nx + j] += sum[(i - 1) * nx + j];
+			if (j > 0)
+				sum[i * nx + j] += sum[i * nx + j - 1];
+			if (i > 0 && j > 0)
+				sum[i * nx + j] -= sum[(i - 1) * nx + j - 1];
+			lowest = min(lowest, sum[i * nx + j]);
+		}
+	}
+
+	/* find the largest rectangle of cells with the lowest number of windows */
+	best = -1;
+	for (i = 0; i < ny - 1; i++) {
+		top = 0;
+		for (j = 0; j <= nx - 1; j++) {
+			if (j < nx - 1)
+				hist[j] = (sum[i * nx + j] == lowest) ? hist[j] + ys[i + 1] - ys[i] : 0;
+			while (top > 0 && (j == nx - 1 || hist[stack[top - 1]] >= hist[j])) {
+				k = stack[--top];
+				left = (top > 0) ? stack[top - 1] + 1 : 0;
+				r.x = xs[left];
+				r.w = xs[j] - xs[left];
+				r.h = hist[k];
+				r.y = ys[i + 1] - r.h;
+				a = (long long)r.w * r.h;
+				if (a > best) {
+					best = a;
+					sub = r;
+				}
+			}
+			stack[top++] = j;
+		}
+	}
+	free(xs);
+	return sub;
+}
+
+/* shrink size to fit into maximum size while maintaining proportion */
+void
+layoutfit(int *w, int *h, int maxw, int maxh)
+{
+	int origw, origh;
+
+	origw = *w;
+	origh = *h;
+	*w = min(origw, maxw);
+	*h = min(origh, maxh);
+	if (origw * *h > origh * *w) {
+		*h = (origh * *w) / origw;
+		*w = (origw * *h) / origh;
+	} else {
+		*w = (origw * *h) / origh;
+		*h = (origh * *w) / origw;
+	}
+}
+
+/* get width of i-th of ntabs tabs sharing width w */
+int
+layouttabwidth(int i, int ntabs, int w)
+{
+	return max(1, ((i + 1) * w / ntabs) - (i * w / ntabs));
+}
+
+/* get geometry of a transient window centered on a frame of size w,h (fullh is its unshaded height) */
+struct Rect
+layouttrans(int maxw, int maxh, int w, int h, int fullh, int border, int minsize)
+{
+	struct Rect r;
+
+	r.w = max(minsize, min(maxw, w - 2 * border));
+	r.h = max(minsize, min(maxh, fullh - 2 * border));
+	r.x = w / 2 - r.w / 2;
+	r.y = h / 2 - r.h / 2;
+	return r;
+}
+
+/* get the region position x,y (relative to frame) is in a frame with content size w,h and border b */
+int
+layoutregion(int x, int y, int w, int h, int b, int button)
+{
+	if (x >= b && x < b + button && y >= b && y < b + button)
+		return FrameButtonLeft;
+	if (x >= b + w - button && x < b + w && y >= b && y < b + button)
+		return FrameButtonRight;
+	if (x >= b + button && y >= b && x < b + w - button && y < b + button)
+		return FrameTitle;
+	if (x < b || y < b || x >= b + w || y >= b + h)
+		return FrameBorder;
+	return FrameNone;
+}
+
+/* get in which corner or side of content of size w,h the position x,y (relative to content) is in */
+enum Octant
+layoutoctant(int x, int y, int w, int h, int corner, int istiled)
+{
+	double tan;
+	int wm, hm;
+
+	if (x >= w - corner && y >= h - corner)
+		return SE;
+	if (x >= w - corner && y <= 0)
+		return NE;
+	if (x <= corner && y >= h - corner)
+		return SW;
+	if (x <= corner && y <= 0)
+		return NW;
+	if (x < 0)
+		return W;
+	if (y < 0)
+		return N;
+	if (x >= w)
+		return E;
+	if (y >= h)
+		return S;
+	wm = w / 2;
+	hm = h / 2;
+	if (istiled) {
+		tan = (double)h/w;
+		if (tan == 0.0)
+			tan = 1.0;
+		if (y >= hm) {
+			h = y - hm;
+			w = h / tan;
+			if (x < wm - w) {
+				return W;
+			} if (x > wm + w) {
+				return E;
+			} else {
+				return S;
+			}
+		} else {
+			h = hm - y;
+			w = h / tan;
+			if (x < wm - w) {
+				return W;
+			} if (x > wm + w) {
+				return E;
+			} else {
+				return N;
+			}
+		}
+		return N;
+	} else {
+		if (x >= wm && y >= hm) {
+			return SE;
+		}
+		if (x >= wm && y <= hm) {
+			return NE;
+		}
+		if (x <= wm && y >= hm) {
+			return SW;
+		}
+		if (x <= wm && y <= hm) {
+			return NW;
+		}
+	}
+	return SE;
+}
+
+/* check whether size changed by d is still at least minsize */
+int
+layoutvalidsize(int size, int d, int minsize)
+{
+	return size + d >= minsize;
+}
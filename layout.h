@@ -0,0 +1,65 @@
+/* frame region */
+enum {
+	FrameNone = 0,
+	FrameButtonLeft = 1,
+	FrameButtonRight = 2,
+	FrameTitle = 3,
+	FrameBorder = 4,
+};
+
+/* window eight sections (aka octants) */
+enum Octant {
+	C  = 0,
+	N  = (1 << 0),
+	S  = (1 << 1),
+	W  = (1 << 2),
+	E  = (1 << 3),
+	NW = (1 << 0) | (1 << 2),
+	NE = (1 << 0) | (1 << 3),
+	SW = (1 << 1) | (1 << 2),
+	SE = (1 << 1) | (1 << 3),
+};
+
+/* rectangle */
+struct Rect {
+	int x, y, w, h;
+};
+
+/* tiled window; the layout reads and updates its row height, border and title bar widths */
+struct Tile {
+	int h;                  /* row height */
+	int ch;                 /* current height of the window */
+	int b, t;               /* border and title bar widths */
+	int isshaded;
+	int isfullscreen;       /* fullscreen windows are not laid out */
+	int issingletab;        /* whether the window has a single tab */
+	int x, y, w;            /* computed position and width of the window contents */
+};
+
+/* column of tiled windows; the layout reads and updates its width */
+struct Tilecol {
+	struct Tile *tiles;
+	int ntiles;
+	int w;                  /* column width */
+};
+
+/* parameters of the tiling layout */
+struct Tileconf {
+	struct Rect area;       /* area to tile, with the outer gaps applied */
+	struct Rect full;       /* area to tile, without the outer gaps */
+	int b;                  /* border width of tiled windows */
+	int g;                  /* gap between tiled windows */
+	int t;                  /* title bar width of tiled windows */
+	int ignoregaps;         /* whether a single tiled window ignores the gaps */
+	int ignoreborders;      /* whether a single tiled window has no borders */
+	int ignoretitle;        /* whether a single tiled window with a single tab has no title bar */
+};
+
+void layouttile(struct Tilecol *cols, int ncols, const struct Tileconf *conf);
+struct Rect layoutplace(const struct Rect *area, const struct Rect *wins, int nwins);
+void layoutfit(int *w, int *h, int maxw, int maxh);
+int layouttabwidth(int i, int ntabs, int w);
+struct Rect layouttrans(int maxw, int maxh, int w, int h, int fullh, int border, int minsize);
+int layoutregion(int x, int y, int w, int h, int b, int button);
+enum Octant layoutoctant(int x, int y, int w, int h, int corner, int istiled);
+int layoutvalidsize(int size, int d, int minsize);
@@ -0,0 +1,93 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "layout.h"
+
+#define NCOLS           4
+#define NROWS           8
+#define NTILEITER       1000000
+#define NPLACEITER      2000
+#define NPLACESETS      16
+
+static volatile int sink;        /* keeps the results from being optimized out */
+
+/* get current time in nanoseconds */
+static double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* time retiling a desktop, as done on each motion of a tiled resize */
+static void
+benchtile(void)
+{
+	struct Tilecol cols[NCOLS];
+	struct Tile tiles[NCOLS * NROWS];
+	struct Tileconf conf = {
+		.area = {0, 0, 1920, 1080},
+		.full = {0, 0, 1920, 1080},
+		.b = 3, .g = 4, .t = 17,
+	};
+	double start, end;
+	int i, j;
+
+	for (i = 0; i < NCOLS; i++) {
+		cols[i].tiles = &tiles[i * NROWS];
+		cols[i].ntiles = NROWS;
+		for (j = 0; j < NROWS; j++)
+			cols[i].tiles[j] = (struct Tile){.ch = 100, .issingletab = 1};
+	}
+	start = now();
+	for (i = 0; i < NTILEITER; i++) {
+		/* change one column width so each iteration recalculates the layout */
+		cols[i % NCOLS].w = i % 512;
+		layouttile(cols, NCOLS, &conf);
+		sink = tiles[0].h;
+	}
+	end = now();
+	printf("layouttile   %2d windows  %10.1f ns/op\n", NCOLS * NROWS, (end - start) / NTILEITER);
+}
+
+/* time placing a window among nwins random ones */
+static void
+benchplace(int nwins)
+{
+	struct Rect area = {0, 0, 1920, 1080};
+	struct Rect *wins, r;
+	double start, end;
+	int i, k;
+
+	if ((wins = calloc(NPLACESETS * nwins, sizeof *wins)) == NULL)
+		err(1, "calloc");
+	for (k = 0; k < NPLACESETS * nwins; k++) {
+		wins[k].x = rand() % area.w;
+		wins[k].y = rand() % area.h;
+		wins[k].w = 100 + rand() % 800;
+		wins[k].h = 100 + rand() % 600;
+	}
+	start = now();
+	for (i = 0; i < NPLACEITER; i++) {
+		r = layoutplace(&area, &wins[(i % NPLACESETS) * nwins], nwins);
+		sink = r.w;
+	}
+	end = now();
+	printf("layoutplace %3d windows  %10.1f ns/op\n", nwins, (end - start) / NPLACEITER);
+	free(wins);
+}
+
+int
+main(void)
+{
+	srand(1);
+	benchtile();
+	benchplace(4);
+	benchplace(16);
+	benchplace(64);
+	benchplace(256);
+	return 0;
+}
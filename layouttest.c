@@ -0,0 +1,258 @@
+#include <err.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "layout.h"
+
+#define NITER           2000
+#define MAXCOLS         6
+#define MAXROWS         6
+#define MINSIZE         8
+#define PLACEW          24      /* size of the area used to check layoutplace() by brute force */
+#define PLACEH          16
+#define MAXPLACE        8
+
+static unsigned seed;
+
+/* get random number in [lo, hi] */
+static int
+rnd(int lo, int hi)
+{
+	return lo + rand() % (hi - lo + 1);
+}
+
+/* report a failed property and exit */
+static void
+fail(int iter, const char *what)
+{
+	errx(1, "seed %u, iteration %d: %s", seed, iter, what);
+}
+
+/* check whether two rectangles overlap */
+static int
+overlap(const struct Rect *a, const struct Rect *b)
+{
+	return a->x < b->x + b->w && b->x < a->x + a->w
+	    && a->y < b->y + b->h && b->y < a->y + a->h;
+}
+
+/* tile random columns over a random area, then check the resulting frames */
+static void
+testtile(int iter)
+{
+	struct Tilecol cols[MAXCOLS];
+	struct Tile tiles[MAXCOLS * MAXROWS];
+	struct Rect frames[MAXCOLS * MAXROWS];
+	struct Tileconf conf;
+	struct Tile *tile;
+	int ncols, nrows, nframes, hasshaded;
+	int sumw, sumh;
+	int i, j, k;
+
+	conf.b = rnd(0, 4);
+	conf.g = rnd(0, 8);
+	conf.t = rnd(0, 16);
+	conf.ignoregaps = rnd(0, 1);
+	conf.ignoreborders = rnd(0, 1);
+	conf.ignoretitle = rnd(0, 1);
+	ncols = rnd(1, MAXCOLS);
+	conf.area.x = rnd(0, 100);
+	conf.area.y = rnd(0, 100);
+	conf.area.w = rnd(ncols * (MINSIZE + 2 * conf.b + conf.g), 2000);
+	conf.area.h = rnd(MAXROWS * (MINSIZE + 2 * conf.b + conf.t + conf.g), 2000);
+	conf.full = conf.area;
+	tile = tiles;
+	for (i = 0; i < ncols; i++) {
+		cols[i].tiles = tile;
+		cols[i].ntiles = rnd(1, MAXROWS);
+		cols[i].w = rnd(MINSIZE, 1000);
+		for (j = 0; j < cols[i].ntiles; j++, tile++) {
+			tile->h = tile->ch = rnd(MINSIZE, 1000);
+			tile->b = conf.b;
+			tile->t = conf.t;
+			tile->isshaded = (rnd(0, 7) == 0);
+			tile->isfullscreen = 0;
+			tile->issingletab = rnd(0, 1);
+		}
+	}
+	layouttile(cols, ncols, &conf);
+
+	/* a single window may ignore the borders and gaps; it must fill the area */
+	if (ncols == 1 && cols[0].ntiles == 1) {
+		tile = &cols[0].tiles[0];
+		if (tile->x - tile->b != conf.area.x || tile->w + 2 * tile->b != conf.area.w)
+			fail(iter, "single window does not fill the area width");
+		if (!tile->isshaded && tile->h + 2 * tile->b + tile->t != conf.area.h)
+			fail(iter, "single window does not fill the area height");
+		return;
+	}
+
+	/* columns, with their borders and gaps, sum to the area width */
+	sumw = conf.g * (ncols - 1);
+	for (i = 0; i < ncols; i++)
+		sumw += cols[i].w + 2 * conf.b;
+	if (sumw != conf.area.w)
+		fail(iter, "columns do not sum to the area width");
+
+	nframes = 0;
+	for (i = 0; i < ncols; i++) {
+		if (cols[i].w < MINSIZE)
+			fail(iter, "column narrower than the minimum size");
+		nrows = cols[i].ntiles;
+		hasshaded = 0;
+		sumh = conf.g * (nrows - 1);
+		for (j = 0; j < nrows; j++) {
+			tile = &cols[i].tiles[j];
+			if (tile->w != cols[i].w)
+				fail(iter, "window width differs from its column width");
+			if (tile->isshaded) {
+				hasshaded = 1;
+				if (tile->h != 0)
+					fail(iter, "shaded window has a height");
+			} else if (tile->h < MINSIZE) {
+				fail(iter, "window shorter than the minimum size");
+			}
+			sumh += tile->h + 2 * tile->b + tile->t;
+			frames[nframes].x = tile->x - tile->b;
+			frames[nframes].y = tile->y - tile->b - tile->t;
+			frames[nframes].w = tile->w + 2 * tile->b;
+			frames[nframes].h = tile->h + 2 * tile->b + tile->t;
+			if (frames[nframes].x < conf.area.x || frames[nframes].y < conf.area.y
+			    || frames[nframes].x + frames[nframes].w > conf.area.x + conf.area.w
+			    || frames[nframes].y + frames[nframes].h > conf.area.y + conf.area.h)
+				fail(iter, "window out of the area");
+			nframes++;
+		}
+
+		/* rows sum to the area height, unless a shaded window gave away its height */
+		if (!hasshaded && sumh != conf.area.h)
+			fail(iter, "rows do not sum to the area height");
+	}
+
+	/* no two windows overlap */
+	for (k = 0; k < nframes; k++)
+		for (j = k + 1; j < nframes; j++)
+			if (overlap(&frames[k], &frames[j]))
+				fail(iter, "windows overlap");
+}
+
+/* place a window among random ones, then compare with the best rectangle found by brute force */
+static void
+testplace(int iter)
+{
+	struct Rect area, wins[MAXPLACE], r;
+	int cover[PLACEH][PLACEW];
+	int sum[PLACEH + 1][PLACEW + 1];        /* number of cells with the lowest cover above and left */
+	int nwins, lowest, best, n;
+	int x0, y0, x1, y1, x, y, k;
+
+	area.x = rnd(0, 50);
+	area.y = rnd(0, 50);
+	area.w = PLACEW;
+	area.h = PLACEH;
+	nwins = rnd(0, MAXPLACE);
+	for (k = 0; k < nwins; k++) {
+		wins[k].x = area.x + rnd(-4, PLACEW);
+		wins[k].y = area.y + rnd(-4, PLACEH);
+		wins[k].w = rnd(1, PLACEW);
+		wins[k].h = rnd(1, PLACEH);
+	}
+	r = layoutplace(&area, wins, nwins);
+	if (r.w <= 0 || r.h <= 0)
+		fail(iter, "placed on an empty rectangle");
+	if (r.x < area.x || r.y < area.y || r.x + r.w > area.x + area.w || r.y + r.h > area.y + area.h)
+		fail(iter, "placed out of the area");
+
+	/* count the windows over each cell */
+	lowest = nwins;
+	for (y = 0; y < PLACEH; y++) {
+		for (x = 0; x < PLACEW; x++) {
+			cover[y][x] = 0;
+			for (k = 0; k < nwins; k++)
+				if (area.x + x >= wins[k].x && area.x + x < wins[k].x + wins[k].w
+				    && area.y + y >= wins[k].y && area.y + y < wins[k].y + wins[k].h)
+					cover[y][x]++;
+			if (cover[y][x] < lowest)
+				lowest = cover[y][x];
+		}
+	}
+	for (y = 0; y <= PLACEH; y++) {
+		for (x = 0; x <= PLACEW; x++) {
+			sum[y][x] = 0;
+			if (x > 0 && y > 0)
+				sum[y][x] = (cover[y - 1][x - 1] == lowest) + sum[y - 1][x] + sum[y][x - 1] - sum[y - 1][x - 1];
+		}
+	}
+
+	/* the placed rectangle is covered by the fewest windows */
+	x0 = r.x - area.x;
+	y0 = r.y - area.y;
+	n = sum[y0 + r.h][x0 + r.w] - sum[y0][x0 + r.w] - sum[y0 + r.h][x0] + sum[y0][x0];
+	if (n != r.w * r.h)
+		fail(iter, "placed over more windows than needed");
+
+	/* and no larger such rectangle exists */
+	best = 0;
+	for (y0 = 0; y0 < PLACEH; y0++)
+		for (x0 = 0; x0 < PLACEW; x0++)
+			for (y1 = y0 + 1; y1 <= PLACEH; y1++)
+				for (x1 = x0 + 1; x1 <= PLACEW; x1++)
+					if ((x1 - x0) * (y1 - y0) > best
+					    && sum[y1][x1] - sum[y0][x1] - sum[y1][x0] + sum[y0][x0] == (x1 - x0) * (y1 - y0))
+						best = (x1 - x0) * (y1 - y0);
+	if (r.w * r.h != best)
+		fail(iter, "placed on a smaller rectangle than possible");
+}
+
+/* check the helpers on random sizes */
+static void
+testmisc(int iter)
+{
+	struct Rect r;
+	int w, h, maxw, maxh, origw, origh;
+	int ntabs, sumw, i;
+
+	/* tabs share exactly the title bar width, when it fits them */
+	ntabs = rnd(1, 20);
+	w = rnd(ntabs, 2000);
+	for (sumw = i = 0; i < ntabs; i++)
+		sumw += layouttabwidth(i, ntabs, w);
+	if (sumw != w)
+		fail(iter, "tabs do not sum to the title bar width");
+
+	/* transients keep the minimum size */
+	r = layouttrans(rnd(1, 2000), rnd(1, 2000), rnd(0, 2000), rnd(0, 2000), rnd(0, 2000), rnd(0, 4), MINSIZE);
+	if (r.w < MINSIZE || r.h < MINSIZE)
+		fail(iter, "transient smaller than the minimum size");
+
+	/* fitted sizes stay within the maximum size */
+	origw = w = rnd(1, 2000);
+	origh = h = rnd(1, 2000);
+	maxw = rnd(1, 2000);
+	maxh = rnd(1, 2000);
+	layoutfit(&w, &h, maxw, maxh);
+	if (w > maxw || h > maxh || w > origw || h > origh)
+		fail(iter, "fitted size exceeds the maximum size");
+
+	/* a resize is valid exactly when it keeps the minimum size */
+	w = rnd(MINSIZE, 2000);
+	i = rnd(-2000, 2000);
+	if (layoutvalidsize(w, i, MINSIZE) != (w + i >= MINSIZE))
+		fail(iter, "resize validity does not match the minimum size");
+}
+
+int
+main(int argc, char *argv[])
+{
+	int i;
+
+	seed = (argc > 1) ? strtoul(argv[1], NULL, 10) : (unsigned)time(NULL);
+	srand(seed);
+	for (i = 0; i < NITER; i++) {
+		testtile(i);
+		testplace(i);
+		testmisc(i);
+	}
+	printf("layouttest: %d iterations passed (seed %u)\n", NITER, seed);
+	return 0;
+}
@@ -1,12 +1,17 @@
 #include <err.h>
+#include <errno.h>
+#include <fcntl.h>
 #include <limits.h>
 #include <locale.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xatom.h>
 #include <X11/Xproto.h>
 #include <X11/Xresource.h>
@@ -14,19 +19,26 @@
 #include <X11/cursorfont.h>
 #include <X11/xpm.h>
 #include <X11/extensions/Xinerama.h>
+#include <X11/extensions/sync.h>
+#include <xcb/xcb.h>
+#include "layout.h"
 #include "shod.h"
 #include "theme.xpm"
 
 /* X stuff */
 static Display *dpy;
+static xcb_connection_t *xcb;
 static Window root;
 static XrmDatabase xdb;
+static struct Ruletab ruletabs[LAST_PREFIX];    /* window rules, compiled from xdb */
 static GC gc;
 static char *xrm;
 static int depth;
 static int screen, screenw, screenh;
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static Atom atoms[AtomLast];
+static int hassync;                     /* whether the server has the SYNC extension */
+static int syncevbase, syncerrbase;
 
 /* visual */
 static struct Decor decor[STYLE_LAST][DECOR_LAST];
@@ -46,24 +58,59 @@ static Window layerwin[LayerLast];      /* dummy windows used to restack clients
 
 /* windows, desktops, monitors */
 static struct Client *clients;
-static struct Client *focuslist;
+static unsigned long focusseq;          /* number of times a client was added to a focus history */
 static struct Client *prevfocused;
 static struct Client *focused;
-static struct Client *raiselist;
 static struct Client *raised;
 static struct Monitor *selmon;
 static struct Monitor *mons;
 static struct Monitor *lastmon;
 static struct Notification *notifications;
+static struct Colchunk *colchunks;      /* allocated columns */
+static struct Rowchunk *rowchunks;      /* allocated rows */
+static struct Column *freecols;         /* unused columns, linked by their next pointer */
+static struct Row *freerows;            /* unused rows, linked by their next pointer */
+static struct Tilecol *tilecols;        /* columns passed to the tiling layout, reused across calls */
+static struct Tile *tiles;              /* windows passed to the tiling layout, reused across calls */
+static int maxtilecols, maxtiles;       /* number of columns and windows allocated */
+static struct Prompt *prompt;           /* prompt being shown, if any */
+static struct Drag drag;                /* operation being performed with the mouse, if any */
+static struct Winmap **wintab;          /* window lookup table */
+static size_t wintabsize;               /* number of buckets of wintab, always a power of two */
+static size_t wintabcount;              /* number of entries in wintab */
 static int showingdesk;
+static int scanning;                    /* whether adopting existing windows at startup */
+static int restacking;                  /* whether deskrestack() will restack the raised clients */
+static int ewmhdirty;                   /* bit mask of root properties to be published */
+static Window activewin;                /* value of _NET_ACTIVE_WINDOW to be published */
+static unsigned long currentdesk;       /* value of _NET_CURRENT_DESKTOP to be published */
+static struct Winlist clientlist = {.rewrite = 1};      /* windows in mapping order */
+static struct Winlist stacklist = {.rewrite = 1};       /* windows in stacking order, bottom to top */
+static struct Client *stackbot[LayerLast];      /* bottommost client of each layer */
+static struct Client *stacktop[LayerLast];      /* topmost client of each layer */
+static unsigned long stackseq;          /* number of times a client was put on top of its layer */
+static size_t stacklayern[LayerLast];   /* number of windows of each layer in stacklist */
+static int stacklowest;                 /* lowest layer changed since stacklist was built */
 static XSetWindowAttributes clientswa = {
 	.event_mask = EnterWindowMask | SubstructureNotifyMask | ExposureMask
 		    | SubstructureRedirectMask | ButtonPressMask | FocusChangeMask
 		    | PointerMotionMask
 };
 
+/* event coalescing */
+static XEvent evbatch[EVBATCHSIZ];
+static struct Evstats evstats;
+
+/* timers, sorted by expiration time */
+static struct Timer *timers;
+
+/* idle jobs, one queue for each priority */
+static struct Idle *idleq[IdleLast];
+
 /* other variables */
+static int sigpipe[2];                  /* signal handlers write into sigpipe[1] to wake up the main loop */
 volatile sig_atomic_t running = 1;
+volatile sig_atomic_t reportstats = 0;
 
 /* include default configuration */
 #include "config.h"
@@ -112,6 +159,17 @@ estrndup(const char *s, size_t maxlen)
 	return p;
 }
 
+/* call realloc checking for error */
+static void *
+erealloc(void *ptr, size_t size)
+{
+	void *p;
+
+	if ((p = realloc(ptr, size)) == NULL)
+		err(1, "realloc");
+	return p;
+}
+
 /* call calloc checking for error */
 static void *
 ecalloc(size_t nmemb, size_t size)
@@ -123,21 +181,182 @@ ecalloc(size_t nmemb, size_t size)
 	return p;
 }
 
-/* get atom property from window */
-static Atom
-getatomprop(Window win, Atom prop)
+/* get current time in miliseconds */
+static long long
+timenow(void)
 {
-	int di;
-	unsigned long dl;
-	unsigned char *p = NULL;
-	Atom da, atom = None;
+	struct timespec ts;
 
-	if (XGetWindowProperty(dpy, win, prop, 0L, sizeof atom, False, XA_ATOM,
-	                       &da, &di, &dl, &dl, &p) == Success && p) {
-		atom = *(Atom *)p;
-		XFree(p);
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == -1)
+		err(1, "clock_gettime");
+	return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* insert timer into the list of timers, keeping it sorted */
+static void
+timerinsert(struct Timer *timer)
+{
+	struct Timer **p;
+
+	for (p = &timers; *p && (*p)->when <= timer->when; p = &(*p)->next)
+		;
+	timer->next = *p;
+	*p = timer;
+}
+
+/* run fn(arg) after ms miliseconds, and then every period miliseconds if period is not 0 */
+static struct Timer *
+timeradd(long ms, long period, void (*fn)(void *), void *arg)
+{
+	struct Timer *timer;
+
+	timer = emalloc(sizeof *timer);
+	timer->fn = fn;
+	timer->arg = arg;
+	timer->when = timenow() + ms;
+	timer->period = period;
+	timerinsert(timer);
+	return timer;
+}
+
+/* cancel timer; one-shot timers must not be cancelled after they have run */
+static void
+timerdel(struct Timer *timer)
+{
+	struct Timer **p;
+
+	for (p = &timers; *p; p = &(*p)->next) {
+		if (*p == timer) {
+			*p = timer->next;
+			free(timer);
+			return;
+		}
+	}
+}
+
+/* get number of miliseconds until next timer expires, or -1 if there is no timer */
+static int
+timerwait(void)
+{
+	long long ms;
+
+	if (timers == NULL)
+		return -1;
+	ms = timers->when - timenow();
+	return (ms < 0) ? 0 : (ms > INT_MAX) ? INT_MAX : (int)ms;
+}
+
+/* run expired timers */
+static void
+timerrun(void)
+{
+	struct Timer *timer;
+	long long now;
+
+	now = timenow();
+	while ((timer = timers) != NULL && timer->when <= now) {
+		timers = timer->next;
+		if (timer->period > 0) {
+			/* reschedule it before running, so fn can cancel it */
+			timer->when += timer->period;
+			if (timer->when <= now)
+				timer->when = now + timer->period;
+			timerinsert(timer);
+			(*timer->fn)(timer->arg);
+		} else {
+			(*timer->fn)(timer->arg);
+			free(timer);
+		}
+	}
+}
+
+/* queue fn(arg) to run when there are no events to be handled, unless it is already queued */
+static void
+idleadd(int prio, void (*fn)(void *), void *arg)
+{
+	struct Idle **p;
+
+	for (p = &idleq[prio]; *p; p = &(*p)->next)
+		if ((*p)->fn == fn && (*p)->arg == arg)
+			return;
+	*p = emalloc(sizeof **p);
+	(*p)->next = NULL;
+	(*p)->fn = fn;
+	(*p)->arg = arg;
+}
+
+/* remove fn(arg) from the idle queues; return whether it was queued */
+static int
+idledel(void (*fn)(void *), void *arg)
+{
+	struct Idle **p, *idle;
+	int i;
+
+	for (i = 0; i < IdleLast; i++) {
+		for (p = &idleq[i]; (idle = *p) != NULL; p = &idle->next) {
+			if (idle->fn == fn && idle->arg == arg) {
+				*p = idle->next;
+				free(idle);
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+/* remove all idle jobs on arg, for arg is about to be freed */
+static void
+idledelarg(void *arg)
+{
+	struct Idle **p, *idle;
+	int i;
+
+	for (i = 0; i < IdleLast; i++) {
+		p = &idleq[i];
+		while ((idle = *p) != NULL) {
+			if (idle->arg == arg) {
+				*p = idle->next;
+				free(idle);
+			} else {
+				p = &idle->next;
+			}
+		}
+	}
+}
+
+/* check whether there are idle jobs queued */
+static int
+idlepending(void)
+{
+	int i;
+
+	for (i = 0; i < IdleLast; i++)
+		if (idleq[i] != NULL)
+			return 1;
+	return 0;
+}
+
+/* run idle jobs by priority until events arrive or the time budget is over */
+static void
+idlerun(void)
+{
+	struct Idle *idle;
+	long long start;
+	int i;
+
+	start = timenow();
+	for (;;) {
+		for (i = 0; i < IdleLast && idleq[i] == NULL; i++)
+			;
+		if (i == IdleLast)
+			return;
+		if (XEventsQueued(dpy, QueuedAfterReading) || timenow() - start >= IDLEBUDGET)
+			return;
+		idle = idleq[i];
+		idleq[i] = idle->next;
+		(*idle->fn)(idle->arg);
+		free(idle);
 	}
-	return atom;
 }
 
 /* get array of unsigned longs from window */
@@ -187,6 +406,140 @@ getwinname(Window win)
 	return name;
 }
 
+/* send requests for the properties used to manage a window, without waiting for the replies */
+static void
+propsrequest(Window win, struct Propcookies *pc)
+{
+	struct {
+		Atom prop;
+		Atom type;
+		long len;
+	} reqs[PropLast] = {
+		[PropWindowType]   = {atoms[NetWMWindowType], XA_ATOM,             1},
+		[PropTransientFor] = {XA_WM_TRANSIENT_FOR,    XA_WINDOW,           1},
+		[PropNormalHints]  = {XA_WM_NORMAL_HINTS,     XA_WM_SIZE_HINTS,    1},
+		[PropHints]        = {XA_WM_HINTS,            XA_WM_HINTS,         1},
+		[PropNetWMName]    = {atoms[NetWMName],       atoms[Utf8String],   NAMEMAXLEN},
+		[PropWMName]       = {XA_WM_NAME,             AnyPropertyType,     NAMEMAXLEN},
+		[PropClass]        = {XA_WM_CLASS,            XA_STRING,           NAMEMAXLEN},
+		[PropRole]         = {atoms[WMWindowRole],    XA_STRING,           NAMEMAXLEN},
+		[PropProtocols]    = {atoms[WMProtocols],     XA_ATOM,             NAMEMAXLEN},
+		[PropSyncCounter]  = {atoms[NetWMSyncRequestCounter], XA_CARDINAL, 1},
+	};
+	int i;
+
+	for (i = 0; i < PropLast; i++) {
+		pc->cookies[i] = xcb_get_property(xcb, 0, win, reqs[i].prop, reqs[i].type, 0, reqs[i].len);
+	}
+}
+
+/* wait for the replies of requests sent by propsrequest() and fill window properties */
+static void
+propsreply(struct Propcookies *pc, struct Winprops *props)
+{
+	xcb_get_property_reply_t *reply;
+	XTextProperty tprop;
+	XSyncCounter counter = None;
+	char **list;
+	char *val;
+	int i, len, n;
+	int hassyncrequest = 0;
+
+	memset(props, 0, sizeof *props);
+	for (i = 0; i < PropLast; i++) {
+		if ((reply = xcb_get_property_reply(xcb, pc->cookies[i], NULL)) == NULL)
+			continue;
+		val = xcb_get_property_value(reply);
+		len = xcb_get_property_value_length(reply);
+		if (reply->type == XCB_NONE || len <= 0) {
+			free(reply);
+			continue;
+		}
+		switch (i) {
+		case PropWindowType:
+			props->type = *(uint32_t *)val;
+			break;
+		case PropTransientFor:
+			props->transfor = *(uint32_t *)val;
+			break;
+		case PropNormalHints:
+			props->isuserplaced = (*(uint32_t *)val & USPosition) != 0;
+			break;
+		case PropHints:
+			props->isurgent = (*(uint32_t *)val & XUrgencyHint) != 0;
+			break;
+		case PropNetWMName:
+			props->name = estrndup(val, min(len, NAMEMAXLEN));
+			break;
+		case PropWMName:
+			if (props->name != NULL)
+				break;
+			tprop.value = (unsigned char *)val;
+			tprop.encoding = reply->type;
+			tprop.format = reply->format;
+			tprop.nitems = len;
+			list = NULL;
+			if (XmbTextPropertyToTextList(dpy, &tprop, &list, &n) == Success &&
+			    n > 0 && list && *list)
+				props->name = estrndup(*list, NAMEMAXLEN);
+			if (list)
+				XFreeStringList(list);
+			break;
+		case PropClass:
+			props->instance = estrndup(val, len);
+			n = strlen(props->instance) + 1;
+			if (n < len && val[n] != '\0')
+				props->class = estrndup(val + n, min(len - n, NAMEMAXLEN));
+			break;
+		case PropRole:
+			props->role = estrndup(val, min(len, NAMEMAXLEN));
+			break;
+		case PropProtocols:
+			for (n = 0; n < len / 4; n++)
+				if (((uint32_t *)val)[n] == atoms[NetWMSyncRequest])
+					hassyncrequest = 1;
+			break;
+		case PropSyncCounter:
+			counter = *(uint32_t *)val;
+			break;
+		}
+		free(reply);
+	}
+	if (hassyncrequest)
+		props->synccounter = counter;
+}
+
+/* discard the replies of requests sent by propsrequest() */
+static void
+propsdiscard(struct Propcookies *pc)
+{
+	int i;
+
+	for (i = 0; i < PropLast; i++) {
+		xcb_discard_reply(xcb, pc->cookies[i].sequence);
+	}
+}
+
+/* get properties used to manage a window, sending all the requests before waiting for any reply */
+static void
+getprops(Window win, struct Winprops *props)
+{
+	struct Propcookies pc;
+
+	propsrequest(win, &pc);
+	propsreply(&pc, props);
+}
+
+/* free strings of window properties */
+static void
+freeprops(struct Winprops *props)
+{
+	free(props->name);
+	free(props->instance);
+	free(props->class);
+	free(props->role);
+}
+
 /* parse buttons string */
 static unsigned int
 parsebuttons(const char *s)
@@ -256,6 +609,15 @@ getresources(void)
 	if (XrmGetResource(xdb, "shod.ignoreIndirect", "*", &type, &xval) == True)
 		config.ignoreindirect = (strcasecmp(xval.addr, "true") == 0 ||
 		                         strcasecmp(xval.addr, "on") == 0);
+	if (XrmGetResource(xdb, "shod.parkDesktops", "*", &type, &xval) == True)
+		config.parkdesktops = (strcasecmp(xval.addr, "true") == 0 ||
+		                       strcasecmp(xval.addr, "on") == 0);
+	if (XrmGetResource(xdb, "shod.liveResize", "*", &type, &xval) == True)
+		config.liveresize = (strcasecmp(xval.addr, "true") == 0 ||
+		                     strcasecmp(xval.addr, "on") == 0);
+	if (XrmGetResource(xdb, "shod.resizeRate", "*", &type, &xval) == True)
+		if ((n = strtol(xval.addr, NULL, 10)) > 0)
+			config.resizerate = n;
 	if (XrmGetResource(xdb, "shod.theme", "*", &type, &xval) == True)
 		config.theme_path = xval.addr;
 	if (XrmGetResource(xdb, "shod.font", "*", &type, &xval) == True)
@@ -273,6 +635,166 @@ getresources(void)
 		config.raisebuttons = parsebuttons(xval.addr);
 }
 
+/* get hash of string */
+static size_t
+strhash(const char *s)
+{
+	size_t h;
+
+	h = 2166136261U;
+	while (*s != '\0')
+		h = (h ^ (unsigned char)*s++) * 16777619U;
+	return h;
+}
+
+/* get rules for key in table of window rules; return NULL if there is none */
+static struct Rules *
+rulesfind(struct Ruletab *tab, const char *key)
+{
+	struct Ruleent *e;
+
+	if (tab->size == 0)
+		return NULL;
+	for (e = tab->buckets[strhash(key) & (tab->size - 1)]; e; e = e->next)
+		if (strcmp(e->key, key) == 0)
+			return &e->rules;
+	return NULL;
+}
+
+/* get rules for key in table of window rules, adding a new entry if there is none */
+static struct Rules *
+rulesget(struct Ruletab *tab, const char *key)
+{
+	struct Ruleent **newbuckets, *e, *next;
+	struct Rules *r;
+	size_t newsize, i, h;
+
+	if ((r = rulesfind(tab, key)) != NULL)
+		return r;
+	if (tab->count >= tab->size) {
+		newsize = (tab->size == 0) ? RULETABSIZ : tab->size * 2;
+		newbuckets = ecalloc(newsize, sizeof *newbuckets);
+		for (i = 0; i < tab->size; i++) {
+			for (e = tab->buckets[i]; e; e = next) {
+				next = e->next;
+				h = strhash(e->key) & (newsize - 1);
+				e->next = newbuckets[h];
+				newbuckets[h] = e;
+			}
+		}
+		free(tab->buckets);
+		tab->buckets = newbuckets;
+		tab->size = newsize;
+	}
+	e = emalloc(sizeof *e);
+	e->key = estrndup(key, NAMEMAXLEN);
+	e->rules.desk = -1;
+	e->rules.state = Normal;
+	e->rules.autotab = NoAutoTab;
+	e->rules.x = e->rules.y = e->rules.w = e->rules.h = -1;
+	h = strhash(key) & (tab->size - 1);
+	e->next = tab->buckets[h];
+	tab->buckets[h] = e;
+	tab->count++;
+	return &e->rules;
+}
+
+/* add resource of the form shod.PREFIX.KEY.SUFFIX into the tables of window rules */
+static Bool
+rulesenum(XrmDatabase *db, XrmBindingList bindings, XrmQuarkList quarks,
+          XrmRepresentation *type, XrmValue *xval, XPointer arg)
+{
+	static char *prefixes[LAST_PREFIX] = {
+		[TITLE] = "title",
+		[INSTANCE] = "instance",
+		[CLASS] = "class",
+		[ROLE] = "role",
+	};
+	static char *suffixes[LAST_SUFFIX] = {
+		[DESKTOP] = "desktop",
+		[STATE] = "state",
+		[AUTOTAB] = "autoTab",
+		[POSITION] = "position",
+	};
+	struct Rules *rules;
+	char key[NAMEMAXLEN];
+	size_t len, n;
+	long d;
+	int i, j, k, nquarks;
+
+	(void)db;
+	(void)type;
+	(void)arg;
+	for (nquarks = 0; quarks[nquarks] != NULLQUARK; nquarks++)
+		if (bindings[nquarks] == XrmBindLoosely)
+			return False;
+	if (nquarks < 4)
+		return False;
+	for (i = 0; i < LAST_PREFIX; i++)
+		if (strcmp(XrmQuarkToString(quarks[1]), prefixes[i]) == 0)
+			break;
+	for (j = 0; j < LAST_SUFFIX; j++)
+		if (strcmp(XrmQuarkToString(quarks[nquarks - 1]), suffixes[j]) == 0)
+			break;
+	if (i == LAST_PREFIX || j == LAST_SUFFIX)
+		return False;
+
+	/* the key is everything between prefix and suffix, it may contain dots */
+	len = 0;
+	key[0] = '\0';
+	for (k = 2; k < nquarks - 1; k++) {
+		n = snprintf(key + len, sizeof key - len, "%s%s", (k > 2 ? "." : ""), XrmQuarkToString(quarks[k]));
+		if (n >= sizeof key - len)
+			return False;
+		len += n;
+	}
+
+	rules = rulesget(&ruletabs[i], key);
+	switch (j) {
+	case DESKTOP:
+		if ((d = strtol(xval->addr, NULL, 10)) > 0 && d <= config.ndesktops)
+			rules->desk = d - 1;
+		break;
+	case STATE:
+		if (strcasecmp(xval->addr, "sticky") == 0)
+			rules->state = Sticky;
+		else if (strcasecmp(xval->addr, "tiled") == 0)
+			rules->state = Tiled;
+		else if (strcasecmp(xval->addr, "minimized") == 0)
+			rules->state = Minimized;
+		break;
+	case AUTOTAB:
+		if (strcasecmp(xval->addr, "floating") == 0)
+			rules->autotab = TabFloating;
+		else if (strcasecmp(xval->addr, "tilingAlways") == 0)
+			rules->autotab = TabTilingAlways;
+		else if (strcasecmp(xval->addr, "tilingMulti") == 0)
+			rules->autotab = TabTilingMulti;
+		else if (strcasecmp(xval->addr, "always") == 0)
+			rules->autotab = TabAlways;
+		break;
+	case POSITION:
+		// TODO
+		break;
+	}
+	return False;
+}
+
+/* compile window rules from X resources */
+static void
+initrules(void)
+{
+	XrmQuark name[2], class[2];
+
+	if (xdb == NULL)
+		return;
+	name[0] = XrmStringToQuark("shod");
+	name[1] = NULLQUARK;
+	class[0] = XrmStringToQuark("Shod");
+	class[1] = NULLQUARK;
+	XrmEnumerateDatabase(xdb, name, class, XrmEnumAllLevels, rulesenum, NULL);
+}
+
 /* get configuration from command-line */
 static void
 getoptions(int argc, char *argv[])
@@ -302,25 +824,6 @@ getoptions(int argc, char *argv[])
 	}
 }
 
-/* get window's WM_STATE property */
-static long
-getstate(Window w)
-{
-	long result = -1;
-	unsigned char *p = NULL;
-	unsigned long n, extra;
-	Atom da;
-	int di;
-
-	if (XGetWindowProperty(dpy, w, atoms[WMState], 0L, 2L, False, atoms[WMState],
-		&da, &di, &n, &extra, (unsigned char **)&p) != Success)
-		return -1;
-	if (n != 0)
-		result = *p;
-	XFree(p);
-	return result;
-}
-
 /* get desktop pointer from desktop index */
 static struct Desktop *
 getdesk(long int n)
@@ -349,7 +852,8 @@ xerror(Display *dpy, XErrorEvent *e)
 	    (e->request_code == X_GrabKey && e->error_code == BadAccess) ||
 	    (e->request_code == X_CopyArea && e->error_code == BadDrawable) ||
 	    (e->request_code == 139 && e->error_code == BadDrawable) ||
-	    (e->request_code == 139 && e->error_code == 143))
+	    (e->request_code == 139 && e->error_code == 143) ||
+	    (hassync && e->error_code == syncerrbase + XSyncBadCounter))
 		return 0;
 
 	errx(1, "Fatal request. Request code=%d, error code=%d", e->request_code, e->error_code);
@@ -360,8 +864,26 @@ xerror(Display *dpy, XErrorEvent *e)
 static void
 siginthandler(int signo)
 {
+	int saveerrno;
+
 	(void)signo;
+	saveerrno = errno;
 	running = 0;
+	(void)write(sigpipe[1], "", 1);
+	errno = saveerrno;
+}
+
+/* report event statistics */
+static void
+sigusr1handler(int signo)
+{
+	int saveerrno;
+
+	(void)signo;
+	saveerrno = errno;
+	reportstats = 1;
+	(void)write(sigpipe[1], "", 1);
+	errno = saveerrno;
 }
 
 /* initialize signals */
@@ -369,6 +891,17 @@ static void
 initsignal(void)
 {
 	struct sigaction sa;
+	int i;
+
+	/* create pipe the signal handlers use to wake up the main loop */
+	if (pipe(sigpipe) == -1)
+		err(1, "pipe");
+	for (i = 0; i < 2; i++) {
+		if (fcntl(sigpipe[i], F_SETFL, O_NONBLOCK) == -1 ||
+		    fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC) == -1) {
+			err(1, "fcntl");
+		}
+	}
 
 	/* remove zombies, we may inherit children when exec'ing shod in .xinitrc */
 	sa.sa_handler = SIG_IGN;
@@ -383,6 +916,13 @@ initsignal(void)
 	sigemptyset(&sa.sa_mask);
 	if (sigaction(SIGINT, &sa, NULL) == -1)
 		err(1, "sigaction");
+
+	/* set reportstats to 1 */
+	sa.sa_handler = sigusr1handler;
+	sa.sa_flags = 0;
+	sigemptyset(&sa.sa_mask);
+	if (sigaction(SIGUSR1, &sa, NULL) == -1)
+		err(1, "sigaction");
 }
 
 /* create dummy windows used for controlling focus and the layer of clients */
@@ -498,6 +1038,8 @@ initatoms(void)
 		[NetWMDesktop]               = "_NET_WM_DESKTOP",
 		[NetFrameExtents]            = "_NET_FRAME_EXTENTS",
 		[NetDesktopViewport]         = "_NET_DESKTOP_VIEWPORT",
+		[NetWMSyncRequest]           = "_NET_WM_SYNC_REQUEST",
+		[NetWMSyncRequestCounter]    = "_NET_WM_SYNC_REQUEST_COUNTER",
 		[ShodTabGroup]               = "_SHOD_TAB_GROUP"
 	};
 
@@ -559,16 +1101,6 @@ initroot(void)
 	XSetInputFocus(dpy, root, RevertToParent, CurrentTime);
 }
 
-/* check whether window was placed by the user */
-static int
-isuserplaced(Window win)
-{
-	XSizeHints size;
-	long dl;
-
-	return (XGetWMNormalHints(dpy, win, &size, &dl) && (size.flags & USPosition));
-}
-
 /* check whether window is urgent */
 static int
 isurgent(Window win)
@@ -692,11 +1224,22 @@ settheme(void)
 	XFreePixmap(dpy, pix);
 }
 
+/* get the most recently focused of two clients, either of which can be NULL */
+static struct Client *
+focusmostrecent(struct Client *a, struct Client *b)
+{
+	if (a == NULL)
+		return b;
+	if (b == NULL)
+		return a;
+	return (a->fseq > b->fseq) ? a : b;
+}
+
 /* get next focused client after old on selected monitor and desktop */
 static struct Client *
 getnextfocused(struct Client *old)
 {
-	struct Client *c;
+	struct Client *c, *s;
 
 	if (old != NULL) {
 		if (old->state == Tiled) {
@@ -710,22 +1253,20 @@ getnextfocused(struct Client *old)
 				return old->row->col->next->row->c;
 			}
 		} else if (old->state == Normal || old->state == Sticky) {
-			for (c = focuslist; c; c = c->fnext) {
-				if (c != old && ((c->state == Sticky && c->mon == selmon) ||
-				    (c->state == Normal && c->desk == selmon->seldesk))) {
-					return c;
-				}
+			for (c = selmon->seldesk->focus; c && (c == old || c->state != Normal); c = c->fnext)
+				;
+			for (s = selmon->stickyfocus; s && s == old; s = s->fnext)
+				;
+			if (c != NULL || s != NULL) {
+				return focusmostrecent(c, s);
 			}
 		}
 	}
-	for (c = focuslist; c; c = c->fnext) {
-		if (c != old && ((c->state == Sticky && c->mon == selmon) ||
-		    ((c->state == Normal || c->state == Tiled) &&
-		    c->desk == selmon->seldesk))) {
-			return c;
-		}
-	}
-	return NULL;
+	for (c = selmon->seldesk->focus; c && c == old; c = c->fnext)
+		;
+	for (s = selmon->stickyfocus; s && s == old; s = s->fnext)
+		;
+	return focusmostrecent(c, s);
 }
 
 static void
@@ -746,15 +1287,15 @@ icccmdeletestate(Window win)
 	XDeleteProperty(dpy, win, atoms[WMState]);
 }
 
+/* set _SHOD_TAB_GROUP on the windows of a client; run as an idle job */
 static void
-shodgroup(struct Client *c)
+shodgroupjob(void *p)
 {
+	struct Client *c = p;
 	struct Tab *t;
 	struct Transient *trans;
 	Window win;
 
-	if (c == NULL)
-		return;
 	win = (c->seltab ? c->seltab->win : None);
 	for (t = c->tabs; t; t = t->next) {
 		XChangeProperty(dpy, t->win, atoms[ShodTabGroup], XA_WINDOW, 32, PropModeReplace, (unsigned char *)&win, 1);
@@ -764,6 +1305,14 @@ shodgroup(struct Client *c)
 	}
 }
 
+static void
+shodgroup(struct Client *c)
+{
+	if (c == NULL)
+		return;
+	idleadd(IdleProperty, shodgroupjob, c);
+}
+
 static void
 ewmhinit(void)
 {
@@ -800,13 +1349,15 @@ ewmhsetallowedactions(Window win)
 static void
 ewmhsetactivewindow(Window w)
 {
-	XChangeProperty(dpy, root, atoms[NetActiveWindow], XA_WINDOW, 32, PropModeReplace, (unsigned char *)&w, 1);
+	activewin = w;
+	ewmhdirty |= DirtyActiveWindow;
 }
 
 static void
 ewmhsetcurrentdesktop(unsigned long n)
 {
-	XChangeProperty(dpy, root, atoms[NetCurrentDesktop], XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&n, 1);
+	currentdesk = n;
+	ewmhdirty |= DirtyCurrentDesktop;
 }
 
 static void
@@ -831,8 +1382,9 @@ ewmhsetstate(struct Client *c)
 {
 	struct Transient *trans;
 	struct Tab *t;
-	Atom data[6];
+	Atom data[7];
 	int n = 0;
+	int m;
 
 	if (c == NULL)
 		return;
@@ -861,9 +1413,13 @@ ewmhsetstate(struct Client *c)
 	else if (c->layer < 0)
 		data[n++] = atoms[NetWMStateBelow];
 	for (t = c->tabs; t; t = t->next) {
-		XChangeProperty(dpy, t->win, atoms[NetWMState], XA_ATOM, 32, PropModeReplace, (unsigned char *)data, n);
+		/* tabs behind the selected one are hidden as well */
+		m = n;
+		if (t->ishidden && c->state != Minimized)
+			data[m++] = atoms[NetWMStateHidden];
+		XChangeProperty(dpy, t->win, atoms[NetWMState], XA_ATOM, 32, PropModeReplace, (unsigned char *)data, m);
 		for (trans = t->trans; trans; trans = trans->next) {
-			XChangeProperty(dpy, trans->win, atoms[NetWMState], XA_ATOM, 32, PropModeReplace, (unsigned char *)data, n);
+			XChangeProperty(dpy, trans->win, atoms[NetWMState], XA_ATOM, 32, PropModeReplace, (unsigned char *)data, m);
 		}
 	}
 }
@@ -874,9 +1430,11 @@ ewmhsetdesktop(Window win, long d)
 	XChangeProperty(dpy, win, atoms[NetWMDesktop], XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&d, 1);
 }
 
+/* set _NET_WM_DESKTOP on the windows of a client; run as an idle job */
 static void
-ewmhsetwmdesktop(struct Client *c)
+ewmhsetwmdesktopjob(void *p)
 {
+	struct Client *c = p;
 	struct Tab *t;
 	struct Transient *trans;
 
@@ -896,6 +1454,12 @@ ewmhsetwmdesktop(struct Client *c)
 	}
 }
 
+static void
+ewmhsetwmdesktop(struct Client *c)
+{
+	idleadd(IdleProperty, ewmhsetwmdesktopjob, c);
+}
+
 static void
 ewmhsetworkarea(int screenw, int screenh)
 {
@@ -909,112 +1473,297 @@ ewmhsetworkarea(int screenw, int screenh)
 	XChangeProperty(dpy, root, atoms[NetWorkarea], XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&data, 4);
 }
 
+/* insert window into array of windows at given position */
 static void
-ewmhsetclients(void)
+winlistinsert(struct Winlist *list, size_t pos, Window win, struct Client *owner)
 {
-	struct Client *c;
-	struct Tab *t;
-	struct Transient *trans;
-	Window *wins = NULL;
-	size_t i = 0, nwins = 0;
-
-	for (c = clients; c; c = c->next) {
-		for (t = c->tabs; t; t = t->next) {
-			for (trans = t->trans; trans; trans = trans->next) {
-				nwins++;
-			}
-			nwins++;
-		}
+	if (list->nwins == list->maxwins) {
+		list->maxwins = (list->maxwins == 0) ? WINLISTSIZ : list->maxwins * 2;
+		list->wins = erealloc(list->wins, list->maxwins * sizeof *list->wins);
+		list->owners = erealloc(list->owners, list->maxwins * sizeof *list->owners);
 	}
-	if (nwins)
-		wins = ecalloc(nwins, sizeof *wins);
-	for (c = clients; c; c = c->next) {
-		for (t = c->tabs; t; t = t->next) {
-			wins[i++] = t->win;
-			for (trans = t->trans; trans; trans = trans->next) {
-				wins[i++] = trans->win;
-			}
-		}
+	memmove(&list->wins[pos + 1], &list->wins[pos], (list->nwins - pos) * sizeof *list->wins);
+	memmove(&list->owners[pos + 1], &list->owners[pos], (list->nwins - pos) * sizeof *list->owners);
+	list->wins[pos] = win;
+	list->owners[pos] = owner;
+	list->nwins++;
+	if (pos < list->npublished) {
+		list->rewrite = 1;
 	}
-	XChangeProperty(dpy, root, atoms[NetClientList], XA_WINDOW, 32,
-	                PropModeReplace, (unsigned char *)wins, i);
-	free(wins);
 }
 
+/* remove window at given position from array of windows */
 static void
-ewmhsetclientsstacking(void)
+winlistremove(struct Winlist *list, size_t pos)
 {
-	struct Client *c, *last;
-	struct Tab *t;
-	struct Transient *trans;
-	Window *wins = NULL;
-	size_t i = 0, nwins = 0;
-
-	last = NULL;
-	for (c = raiselist; c; c = c->rnext) {
-		last = c;
-		for (t = c->tabs; t; t = t->next) {
-			for (trans = t->trans; trans; trans = trans->next) {
-				nwins++;
-			}
-			nwins++;
-		}
-	}
-	if (nwins)
-		wins = ecalloc(nwins, sizeof *wins);
-	for (c = last; c; c = c->rprev) {
-		for (t = c->tabs; t; t = t->next) {
-			if (c->state == Tiled && !c->isfullscreen) {
-				wins[i++] = t->win;
-				for (trans = t->trans; trans; trans = trans->next) {
-					wins[i++] = trans->win;
-				}
-			}
-		}
+	memmove(&list->wins[pos], &list->wins[pos + 1], (list->nwins - pos - 1) * sizeof *list->wins);
+	memmove(&list->owners[pos], &list->owners[pos + 1], (list->nwins - pos - 1) * sizeof *list->owners);
+	list->nwins--;
+	if (pos < list->npublished) {
+		list->rewrite = 1;
 	}
-	for (c = last; c; c = c->rprev) {
-		for (t = c->tabs; t; t = t->next) {
-			if (c->state != Tiled && !c->isfullscreen && c->layer < 0) {
-				wins[i++] = t->win;
-				for (trans = t->trans; trans; trans = trans->next) {
-					wins[i++] = trans->win;
-				}
-			}
-		}
+}
+
+/* get position of window in array of windows; return number of windows if not found */
+static size_t
+winlistfind(struct Winlist *list, Window win)
+{
+	size_t i;
+
+	for (i = 0; i < list->nwins; i++)
+		if (list->wins[i] == win)
+			break;
+	return i;
+}
+
+/* publish array of windows, appending to the property unless it has to be rewritten */
+static void
+winlistpublish(struct Winlist *list, Atom prop)
+{
+	if (list->rewrite) {
+		XChangeProperty(dpy, root, prop, XA_WINDOW, 32, PropModeReplace,
+		                (unsigned char *)list->wins, list->nwins);
+	} else if (list->nwins > list->npublished) {
+		XChangeProperty(dpy, root, prop, XA_WINDOW, 32, PropModeAppend,
+		                (unsigned char *)&list->wins[list->npublished],
+		                list->nwins - list->npublished);
 	}
-	for (c = last; c; c = c->rprev) {
-		for (t = c->tabs; t; t = t->next) {
-			if (c->state != Tiled && !c->isfullscreen && c->layer == 0) {
-				wins[i++] = t->win;
+	list->npublished = list->nwins;
+	list->rewrite = 0;
+}
+
+/* add window to the end of the client list */
+static void
+ewmhaddclient(Window win)
+{
+	winlistinsert(&clientlist, clientlist.nwins, win, NULL);
+	ewmhdirty |= DirtyClientList;
+}
+
+/* remove window from the client list */
+static void
+ewmhdelclient(Window win)
+{
+	size_t i;
+
+	if ((i = winlistfind(&clientlist, win)) < clientlist.nwins) {
+		winlistremove(&clientlist, i);
+		ewmhdirty |= DirtyClientList;
+	}
+}
+
+/* get the layer a client is stacked in */
+static int
+clientlayer(struct Client *c)
+{
+	if (c->isfullscreen)
+		return LayerFullscreen;
+	if (c->state == Tiled)
+		return LayerTiled;
+	if (c->layer < 0)
+		return LayerBelow;
+	if (c->layer > 0)
+		return LayerAbove;
+	return LayerTop;
+}
+
+/* remove client from the stacking list of its layer */
+static void
+stackunlink(struct Client *c)
+{
+	if (c->snext)
+		c->snext->sprev = c->sprev;
+	else
+		stacktop[c->slayer] = c->sprev;
+	if (c->sprev)
+		c->sprev->snext = c->snext;
+	else
+		stackbot[c->slayer] = c->snext;
+	c->sprev = c->snext = NULL;
+	stacklowest = min(stacklowest, c->slayer);
+	ewmhdirty |= DirtyClientListStacking;
+}
+
+/* put client on top of the stacking list of its layer */
+static void
+stacklink(struct Client *c)
+{
+	c->slayer = clientlayer(c);
+	c->snext = NULL;
+	c->sprev = stacktop[c->slayer];
+	if (stacktop[c->slayer])
+		stacktop[c->slayer]->snext = c;
+	else
+		stackbot[c->slayer] = c;
+	stacktop[c->slayer] = c;
+	c->sseq = ++stackseq;
+	stacklowest = min(stacklowest, c->slayer);
+	ewmhdirty |= DirtyClientListStacking;
+}
+
+/* move client on top of its layer in the stacking list */
+static void
+stackraise(struct Client *c)
+{
+	if (c->slayer == clientlayer(c) && stacktop[c->slayer] == c)
+		return;
+	stackunlink(c);
+	stacklink(c);
+}
+
+static void
+ewmhpublishclients(void)
+{
+	winlistpublish(&clientlist, atoms[NetClientList]);
+}
+
+/* put window at given position of the stacking list, unless it is already there */
+static void
+stacklistset(size_t pos, Window win, struct Client *owner)
+{
+	if (pos == stacklist.nwins) {
+		winlistinsert(&stacklist, pos, win, owner);
+		return;
+	}
+	if (stacklist.wins[pos] != win && pos < stacklist.npublished)
+		stacklist.rewrite = 1;
+	stacklist.wins[pos] = win;
+	stacklist.owners[pos] = owner;
+}
+
+/*
+ * Rebuild the stacking list from the lowest layer changed since last
+ * call; the layers below it are kept as they are.  Windows that end up
+ * at the same position are not counted as changes, so adding a window
+ * on top of the topmost layer in use only appends to the property.
+ */
+static void
+ewmhpublishclientsstacking(void)
+{
+	struct Transient *trans;
+	struct Client *c;
+	struct Tab *t;
+	size_t pos, first;
+	int i;
+
+	for (pos = 0, i = 0; i < stacklowest; i++)
+		pos += stacklayern[i];
+	for (; i < LayerLast; i++) {
+		first = pos;
+		for (c = stackbot[i]; c; c = c->snext) {
+			for (t = c->tabs; t; t = t->next) {
+				stacklistset(pos++, t->win, c);
 				for (trans = t->trans; trans; trans = trans->next) {
-					wins[i++] = trans->win;
+					stacklistset(pos++, trans->win, c);
 				}
 			}
 		}
+		stacklayern[i] = pos - first;
 	}
-	for (c = last; c; c = c->rprev) {
-		for (t = c->tabs; t; t = t->next) {
-			if (c->state != Tiled && !c->isfullscreen && c->layer > 0) {
-				wins[i++] = t->win;
-				for (trans = t->trans; trans; trans = trans->next) {
-					wins[i++] = trans->win;
-				}
-			}
+	if (pos < stacklist.npublished)
+		stacklist.rewrite = 1;
+	stacklist.nwins = pos;
+	stacklowest = LayerLast;
+	winlistpublish(&stacklist, atoms[NetClientListStacking]);
+}
+
+static void
+ewmhsetclients(void)
+{
+	ewmhdirty |= DirtyClientList;
+}
+
+/* rebuild the whole stacking list on next flush, as windows were added to or removed from clients */
+static void
+ewmhsetclientsstacking(void)
+{
+	stacklowest = 0;
+	ewmhdirty |= DirtyClientListStacking;
+}
+
+/* publish the root properties changed since last call */
+static void
+ewmhflush(void)
+{
+	if (ewmhdirty & DirtyClientList)
+		ewmhpublishclients();
+	if (ewmhdirty & DirtyClientListStacking)
+		ewmhpublishclientsstacking();
+	if (ewmhdirty & DirtyActiveWindow)
+		XChangeProperty(dpy, root, atoms[NetActiveWindow], XA_WINDOW, 32, PropModeReplace, (unsigned char *)&activewin, 1);
+	if (ewmhdirty & DirtyCurrentDesktop)
+		XChangeProperty(dpy, root, atoms[NetCurrentDesktop], XA_CARDINAL, 32, PropModeReplace, (unsigned char *)&currentdesk, 1);
+	ewmhdirty = 0;
+}
+
+/* get bucket of the window lookup table a window hashes into */
+static size_t
+winhash(Window win, size_t size)
+{
+	return (size_t)((win * 2654435761UL) >> 7) & (size - 1);
+}
+
+/* double the number of buckets of the window lookup table */
+static void
+wintabgrow(void)
+{
+	struct Winmap **newtab, *e, *next;
+	size_t newsize, i, h;
+
+	newsize = (wintabsize == 0) ? WINTABSIZ : wintabsize * 2;
+	newtab = ecalloc(newsize, sizeof *newtab);
+	for (i = 0; i < wintabsize; i++) {
+		for (e = wintab[i]; e; e = next) {
+			next = e->next;
+			h = winhash(e->win, newsize);
+			e->next = newtab[h];
+			newtab[h] = e;
 		}
 	}
-	for (c = last; c; c = c->rprev) {
-		for (t = c->tabs; t; t = t->next) {
-			if (c->isfullscreen) {
-				wins[i++] = t->win;
-				for (trans = t->trans; trans; trans = trans->next) {
-					wins[i++] = trans->win;
-				}
-			}
+	free(wintab);
+	wintab = newtab;
+	wintabsize = newsize;
+}
+
+/* map window to the notification, client, tab or transient it belongs to */
+static void
+winmapadd(Window win, struct Notification *n, struct Client *c, struct Tab *t, struct Transient *trans)
+{
+	struct Winmap *e;
+	size_t h;
+
+	if (win == None)
+		return;
+	if (wintabcount >= wintabsize)
+		wintabgrow();
+	h = winhash(win, wintabsize);
+	e = emalloc(sizeof *e);
+	e->win = win;
+	e->n = n;
+	e->c = c;
+	e->t = t;
+	e->trans = trans;
+	e->next = wintab[h];
+	wintab[h] = e;
+	wintabcount++;
+}
+
+/* remove window from the window lookup table */
+static void
+winmapdel(Window win)
+{
+	struct Winmap **p, *e;
+
+	if (win == None || wintabsize == 0)
+		return;
+	for (p = &wintab[winhash(win, wintabsize)]; (e = *p) != NULL; p = &e->next) {
+		if (e->win == win) {
+			*p = e->next;
+			free(e);
+			wintabcount--;
+			return;
 		}
 	}
-	XChangeProperty(dpy, root, atoms[NetClientListStacking], XA_WINDOW, 32,
-	                PropModeReplace, (unsigned char *)wins, i);
-	free(wins);
 }
 
 /* get pointer to client, tab or transient structure given a window */
@@ -1022,43 +1771,31 @@ static struct Winres
 getwin(Window win)
 {
 	struct Winres res;
-	struct Client *c;
-	struct Tab *t;
-	struct Transient *trans;
-	struct Notification *n;
+	struct Winmap *e;
 
 	res.n = NULL;
 	res.c = NULL;
 	res.t = NULL;
 	res.trans = NULL;
-	for (n = notifications; n; n = n->next) {
-		if (win == n->frame || win == n->win) {
-			res.n = n;
-			goto done;
-		}
-	}
-	for (c = clients; c; c = c->next) {
-		if (win == c->frame || win == c->curswin) {
-			res.c = c;
-			goto done;
-		}
-		for (t = c->tabs; t; t = t->next) {
-			if (win == t->win || win == t->frame || win == t->title) {
-				res.c = c;
-				res.t = t;
-				goto done;
-			}
-			for (trans = t->trans; trans; trans = trans->next) {
-				if (win == trans->win || win == trans->frame) {
-					res.c = c;
-					res.t = t;
-					res.trans = trans;
-					goto done;
-				}
-			}
-		}
+	if (win == None || wintabsize == 0)
+		return res;
+	for (e = wintab[winhash(win, wintabsize)]; e; e = e->next)
+		if (e->win == win)
+			break;
+	if (e == NULL)
+		return res;
+	if (e->trans) {
+		res.trans = e->trans;
+		res.t = e->trans->t;
+		res.c = e->trans->t->c;
+	} else if (e->t) {
+		res.t = e->t;
+		res.c = e->t->c;
+	} else if (e->c) {
+		res.c = e->c;
+	} else {
+		res.n = e->n;
 	}
-done:
 	return res;
 }
 
@@ -1079,14 +1816,13 @@ getmon(int x, int y)
 static struct Client *
 getfullscreen(struct Monitor *mon, struct Desktop *desk)
 {
-	struct Client *c;
+	struct Client *c, *s;
 
-	for (c = focuslist; c; c = c->fnext)
-		if (c->isfullscreen &&
-		    (((c->state == Normal || c->state == Tiled) && c->desk == desk) ||
-		     (c->state == Sticky && c->mon == mon)))
-			return c;
-	return NULL;
+	for (c = (desk != NULL) ? desk->focus : NULL; c && !c->isfullscreen; c = c->fnext)
+		;
+	for (s = (mon != NULL) ? mon->stickyfocus : NULL; s && !s->isfullscreen; s = s->fnext)
+		;
+	return focusmostrecent(c, s);
 }
 
 /* compute position and width of tabs of a client */
@@ -1095,45 +1831,25 @@ calctabs(struct Client *c)
 {
 	struct Transient *trans;
 	struct Tab *t;
+	struct Rect r;
 	int i, x;
 
 	x = 0;
 	for (i = 0, t = c->tabs; t; t = t->next, i++) {
-		t->w = max(1, ((i + 1) * (c->w - 2 * button) / c->ntabs) - (i * (c->w - 2 * button) / c->ntabs));
+		t->w = layouttabwidth(i, c->ntabs, c->w - 2 * button);
 		t->x = x;
 		x += t->w;
 		for (trans = t->trans; trans; trans = trans->next) {
-			trans->w = max(minsize, min(trans->maxw, c->w - 2 * border));
-			trans->h = max(minsize, min(trans->maxh, (c->isshaded ? c->saveh : c->h) - 2 * border));
-			trans->x = c->w / 2 - trans->w / 2;
-			trans->y = c->h / 2 - trans->h / 2;
+			r = layouttrans(trans->maxw, trans->maxh, c->w, c->h,
+			                (c->isshaded ? c->saveh : c->h), border, minsize);
+			trans->x = r.x;
+			trans->y = r.y;
+			trans->w = r.w;
+			trans->h = r.h;
 		}
 	}
 }
 
-/* focus a tab */
-static void
-tabfocus(struct Tab *t)
-{
-	if (t == NULL)
-		return;
-	t->c->seltab = t;
-	if (t->isurgent)
-		tabclearurgency(t);
-	XRaiseWindow(dpy, t->frame);
-	if (t->c->isshaded) {
-		XSetInputFocus(dpy, t->c->frame, RevertToParent, CurrentTime);
-	} else if (t->trans) {
-		XRaiseWindow(dpy, t->trans->frame);
-		XSetInputFocus(dpy, t->trans->win, RevertToParent, CurrentTime);
-		ewmhsetactivewindow(t->trans->win);
-	} else {
-		XSetInputFocus(dpy, t->win, RevertToParent, CurrentTime);
-		ewmhsetactivewindow(t->win);
-	}
-	shodgroup(t->c);
-}
-
 /* get tab decoration style */
 static int
 tabgetstyle(struct Tab *t)
@@ -1145,29 +1861,6 @@ tabgetstyle(struct Tab *t)
 	return UNFOCUSED;
 }
 
-/* delete transient window from tab */
-static void
-transdel(struct Transient *trans)
-{
-	struct Tab *t;
-
-	t = trans->t;
-	if (trans->next)
-		trans->next->prev = trans->prev;
-	if (trans->prev)
-		trans->prev->next = trans->next;
-	else
-		t->trans = trans->next;
-	shodgroup(t->c);
-	if (trans->pix != None)
-		XFreePixmap(dpy, trans->pix);
-	icccmdeletestate(trans->win);
-	XReparentWindow(dpy, trans->win, root, 0, 0);
-	XDestroyWindow(dpy, trans->frame);
-	tabfocus(t);
-	free(trans);
-}
-
 /* decorate transient window */
 static void
 transdecorate(struct Transient *trans)
@@ -1230,6 +1923,8 @@ transdecorate(struct Transient *trans)
 static void
 tabdetach(struct Tab *t, int x, int y)
 {
+	struct Transient *trans;
+
 	t->winw = t->c->fw;
 	t->winh = t->c->fh;
 	if (t->c->seltab == t) {
@@ -1241,6 +1936,15 @@ tabdetach(struct Tab *t, int x, int y)
 	}
 	t->c->ntabs--;
 	t->ignoreunmap = IGNOREUNMAP;
+	if (!t->ishidden) {
+		/* the tab is not viewable until it is attached again */
+		XUnmapWindow(dpy, t->frame);
+		icccmwmstate(t->win, IconicState);
+		for (trans = t->trans; trans; trans = trans->next)
+			icccmwmstate(trans->win, IconicState);
+		t->ishidden = 1;
+		ewmhsetstate(t->c);
+	}
 	XReparentWindow(dpy, t->title, root, x, y);
 	if (t->next)
 		t->next->prev = t->prev;
@@ -1260,28 +1964,6 @@ tabmove(struct Tab *t, int x, int y)
 	XMoveWindow(dpy, t->title, x, y);
 }
 
-/* delete tab from client */
-static void
-tabdel(struct Tab *t)
-{
-	struct Client *c;
-
-	c = t->c;
-	while (t->trans)
-		transdel(t->trans);
-	tabdetach(t, 0, 0);
-	shodgroup(c);
-	if (t->pix != None)
-		XFreePixmap(dpy, t->pix);
-	icccmdeletestate(t->win);
-	XReparentWindow(dpy, t->win, root, c->x, c->y);
-	XDestroyWindow(dpy, t->title);
-	XDestroyWindow(dpy, t->frame);
-	free(t->name);
-	free(t->class);
-	free(t);
-}
-
 /* update tab title */
 static void
 tabupdatetitle(struct Tab *t)
@@ -1308,7 +1990,7 @@ tabupdateclass(struct Tab *t)
 
 /* add tab into client */
 static struct Tab *
-tabadd(Window win, char *name, char *class, int ignoreunmap)
+tabadd(Window win, char *name, char *class, int isurgent, int ignoreunmap)
 {
 	struct Tab *t;
 
@@ -1320,17 +2002,25 @@ tabadd(Window win, char *name, char *class, int ignoreunmap)
 	t->title = None;
 	t->name = name;
 	t->class = class;
+	t->titletimer = NULL;
+	t->synccounter = None;
+	t->syncvalue = 0;
 	t->ignoreunmap = ignoreunmap;
-	t->isurgent = isurgent(win);
+	t->isurgent = isurgent;
 	t->pix = None;
 	t->pw = 0;
+	t->nx = t->ny = t->nw = t->nh = -1;
+	t->ishidden = 1;
 	t->frame = XCreateWindow(dpy, root, 0, 0, 1, 1, 0,
 	                         CopyFromParent, CopyFromParent, CopyFromParent,
 	                         CWEventMask, &clientswa);
 	t->win = win;
+	winmapadd(t->win, NULL, NULL, t, NULL);
+	winmapadd(t->frame, NULL, NULL, t, NULL);
 	XReparentWindow(dpy, t->win, t->frame, 0, 0);
 	icccmwmstate(win, NormalState);
 	ewmhsetallowedactions(win);
+	ewmhaddclient(win);
 	return t;
 }
 
@@ -1428,29 +2118,68 @@ clientisvisible(struct Client *c)
 	return 0;
 }
 
-/* notify client of configuration changing */
+/* notify client windows whose geometry changed since they were last notified */
 static void
 clientnotify(struct Client *c)
 {
 	struct Tab *t;
 	struct Transient *trans;
+	int x, y, h;
 
 	if (c == NULL)
 		return;
+	h = c->isshaded ? c->saveh : c->h;
 	for (t = c->tabs; t; t = t->next) {
-		notify(t->win, c->x, c->y, c->w, c->isshaded ? c->saveh : c->h);
+		/* background tabs are notified once selected and resized, unless they request it */
+		if (!t->ishidden && (t->nx != c->x || t->ny != c->y || t->nw != c->w || t->nh != h)) {
+			notify(t->win, c->x, c->y, c->w, h);
+			t->nx = c->x;
+			t->ny = c->y;
+			t->nw = c->w;
+			t->nh = h;
+		}
 		for (trans = t->trans; trans; trans = trans->next) {
-			notify(trans->win, trans->x, trans->y, trans->w, trans->h);
+			if (t->ishidden && trans->nw != -1)
+				continue;
+			/* transients are placed relative to the tab, but notified of their root position */
+			x = c->x + trans->x;
+			y = c->y + trans->y;
+			if (trans->nx != x || trans->ny != y ||
+			    trans->nw != trans->w || trans->nh != trans->h) {
+				notify(trans->win, x, y, trans->w, trans->h);
+				trans->nx = x;
+				trans->ny = y;
+				trans->nw = trans->w;
+				trans->nh = trans->h;
+			}
 		}
 	}
 }
 
+/* answer a configure request of a background tab with the geometry it kept when last selected */
+static void
+tabnotifyhidden(struct Tab *t)
+{
+	XWindowAttributes wa;
+
+	if (t->nw < 0) {        /* never resized by us */
+		if (!XGetWindowAttributes(dpy, t->win, &wa))
+			return;
+		t->nw = wa.width;
+		t->nh = wa.height;
+	}
+	t->nx = t->c->x;
+	t->ny = t->c->y;
+	notify(t->win, t->nx, t->ny, t->nw, t->nh);
+}
+
 /* draw decoration on the frame window */
 static void
-clientdecorate(struct Client *c, int decorateall, enum Octant octant, int region)
+clientdraw(struct Client *c, int decorateall, enum Octant octant, int region)
 {
 	XGCValues val;
 	struct Tab *t;
+	struct Transient *trans;
 	struct Decor *d;        /* unpressed decoration */
 	struct Decor *dp;       /* pressed decoration */
 	int style;
@@ -1459,8 +2188,6 @@ clientdecorate(struct Client *c, int decorateall, enum Octant octant, int region
 	int fullw, fullh;
 	int j;
 
-	if (c == NULL)
-		return;
 	style = clientgetstyle(c);
 	j = UNPRESSED;
 	if ((c->state & Tiled) && config.mergeborders)
@@ -1544,8 +2271,8 @@ clientdecorate(struct Client *c, int decorateall, enum Octant octant, int region
 	}
 	if (decorateall) {
 		for (t = c->tabs; t; t = t->next) {
-			if (t->trans) {
-				transdecorate(t->trans);
+			for (trans = t->trans; trans; trans = trans->next) {
+				transdecorate(trans);
 			}
 			if (c->t > 0) {
 				tabdecorate(t, FrameNone);
@@ -1555,6 +2282,26 @@ clientdecorate(struct Client *c, int decorateall, enum Octant octant, int region
 	XCopyArea(dpy, c->pix, c->frame, gc, 0, 0, fullw, fullh, 0, 0);
 }
 
+/* redraw decoration of a hidden client; run as an idle job */
+static void
+clientdecorateidle(void *p)
+{
+	clientdraw((struct Client *)p, 1, 0, FrameNone);
+}
+
+/* draw decoration now, or when idle if the client is not visible */
+static void
+clientdecorate(struct Client *c, int decorateall, enum Octant octant, int region)
+{
+	if (c == NULL || scanning)      /* scan() decorates each client once at the end */
+		return;
+	if (c->ishidden && octant == 0 && region == FrameNone) {
+		idleadd(IdleDecoration, clientdecorateidle, c);
+		return;
+	}
+	clientdraw(c, decorateall, octant, region);
+}
+
 /* set client border width */
 static void
 clientborderwidth(struct Client *c, int border)
@@ -1580,13 +2327,37 @@ clientretab(struct Client *c)
 	struct Transient *trans;
 	struct Tab *t;
 	int transx, transy, transw, transh;
+	int state;
+	int changed = 0;        /* whether a tab was moved to or from the background */
 	int i;
 
+	state = (c->ishidden && !c->isparked) ? IconicState : NormalState;
 	for (i = 0, t = c->tabs; t; t = t->next, i++) {
-		if (c->isshaded) {
-			XMoveResizeWindow(dpy, t->frame, c->b, 2 * c->b + c->t, c->w, c->saveh);
+		if (t != c->seltab) {
+			/* background tabs are unmapped, and resized only once selected */
+			if (!t->ishidden) {
+				XUnmapWindow(dpy, t->frame);
+				icccmwmstate(t->win, IconicState);
+				for (trans = t->trans; trans; trans = trans->next)
+					icccmwmstate(trans->win, IconicState);
+				t->ishidden = 1;
+				changed = 1;
+			}
 		} else {
-			XMoveResizeWindow(dpy, t->frame, c->b, c->b + c->t, c->w, c->h);
+			if (c->isshaded) {
+				XMoveResizeWindow(dpy, t->frame, c->b, 2 * c->b + c->t, c->w, c->saveh);
+			} else {
+				XMoveResizeWindow(dpy, t->frame, c->b, c->b + c->t, c->w, c->h);
+			}
+			XResizeWindow(dpy, t->win, c->w, (c->isshaded ? c->saveh : c->h));
+			if (t->ishidden) {
+				XMapWindow(dpy, t->frame);
+				icccmwmstate(t->win, state);
+				for (trans = t->trans; trans; trans = trans->next)
+					icccmwmstate(trans->win, state);
+				t->ishidden = 0;
+				changed = 1;
+			}
 		}
 		for (trans = t->trans; trans; trans = trans->next) {
 			transx = trans->x - border;
@@ -1599,7 +2370,6 @@ clientretab(struct Client *c)
 				transdecorate(trans);
 			}
 		}
-		XResizeWindow(dpy, t->win, c->w, (c->isshaded ? c->saveh : c->h));
 		if (c->t > 0) {
 			XMapWindow(dpy, t->title);
 			XMoveResizeWindow(dpy, t->title, c->b + button + t->x, c->b, t->w, c->t);
@@ -1610,9 +2380,99 @@ clientretab(struct Client *c)
 			tabdecorate(t, 0);
 		}
 	}
+	if (changed)
+		ewmhsetstate(c);
 	clientnotify(c);
 }
 
+/* focus a tab */
+static void
+tabfocus(struct Tab *t)
+{
+	if (t == NULL)
+		return;
+	if (t->c->seltab != t || t->ishidden) {
+		t->c->seltab = t;
+		clientretab(t->c);
+	}
+	if (t->isurgent)
+		tabclearurgency(t);
+	if (t->c->isshaded) {
+		XSetInputFocus(dpy, t->c->frame, RevertToParent, CurrentTime);
+	} else if (t->trans) {
+		XRaiseWindow(dpy, t->trans->frame);
+		XSetInputFocus(dpy, t->trans->win, RevertToParent, CurrentTime);
+		ewmhsetactivewindow(t->trans->win);
+	} else {
+		XSetInputFocus(dpy, t->win, RevertToParent, CurrentTime);
+		ewmhsetactivewindow(t->win);
+	}
+	shodgroup(t->c);
+}
+
+/* delete transient window from tab */
+static void
+transdel(struct Transient *trans)
+{
+	struct Tab *t;
+
+	t = trans->t;
+	if (trans->next)
+		trans->next->prev = trans->prev;
+	if (trans->prev)
+		trans->prev->next = trans->next;
+	else
+		t->trans = trans->next;
+	shodgroup(t->c);
+	if (trans->pix != None)
+		XFreePixmap(dpy, trans->pix);
+	icccmdeletestate(trans->win);
+	ewmhdelclient(trans->win);
+	ewmhsetclientsstacking();
+	winmapdel(trans->win);
+	winmapdel(trans->frame);
+	XReparentWindow(dpy, trans->win, root, 0, 0);
+	XDestroyWindow(dpy, trans->frame);
+	tabfocus(t);
+	free(trans);
+}
+
+/* delete tab from client */
+static void
+tabdel(struct Tab *t)
+{
+	struct Client *c;
+
+	c = t->c;
+	while (t->trans)
+		transdel(t->trans);
+	if (t->titletimer != NULL)
+		timerdel(t->titletimer);
+	tabdetach(t, 0, 0);
+	shodgroup(c);
+	if (t->pix != None)
+		XFreePixmap(dpy, t->pix);
+	icccmdeletestate(t->win);
+	ewmhdelclient(t->win);
+	ewmhsetclientsstacking();
+	winmapdel(t->win);
+	winmapdel(t->frame);
+	winmapdel(t->title);
+	XReparentWindow(dpy, t->win, root, c->x, c->y);
+	XDestroyWindow(dpy, t->title);
+	XDestroyWindow(dpy, t->frame);
+	free(t->name);
+	free(t->class);
+	free(t);
+}
+
+/* get x position of a parked frame, far enough left for neither its current nor its committed width to show */
+static int
+clientparkx(struct Client *c)
+{
+	return -max(WIDTH(c), c->cw + 2 * c->cb);
+}
+
 /* commit floating client size and position */
 static void
 clientmoveresize(struct Client *c)
@@ -1621,19 +2481,45 @@ clientmoveresize(struct Client *c)
 
 	if (c == NULL)
 		return;
-	x = c->x - c->b;
-	y = c->y - c->b - c->t;
 	w = WIDTH(c);
 	h = HEIGHT(c);
+	x = c->isparked ? clientparkx(c) : c->x - c->b;
+	y = c->y - c->b - c->t;
 	calctabs(c);
 	XMoveResizeWindow(dpy, c->frame, x, y, w, h);
 	XMoveResizeWindow(dpy, c->curswin, 0, 0, w, h);
 	clientretab(c);
+	c->cx = c->x;
+	c->cy = c->y;
+	c->cw = c->w;
+	c->ch = c->h;
+	c->cb = c->b;
+	c->ct = c->t;
 	if (c->pw != w || c->ph != h) {
 		clientdecorate(c, 0, 0, FrameNone);
 	}
 }
 
+/* check whether client geometry changed since it was last committed to the frame */
+static int
+clientchanged(struct Client *c)
+{
+	return c->x != c->cx || c->y != c->cy || c->w != c->cw ||
+	       c->h != c->ch || c->b != c->cb || c->t != c->ct;
+}
+
+/* commit floating client position, when its size has not changed */
+static void
+clientmove(struct Client *c)
+{
+	if (c == NULL)
+		return;
+	XMoveWindow(dpy, c->frame, c->isparked ? clientparkx(c) : c->x - c->b, c->y - c->b - c->t);
+	clientnotify(c);
+	c->cx = c->x;
+	c->cy = c->y;
+}
+
 /* check if desktop is visible */
 static int
 deskisvisible(struct Desktop *desk)
@@ -1663,129 +2549,151 @@ desktile(struct Desktop *desk)
 	struct Monitor *mon;
 	struct Column *col;
 	struct Row *row;
-	int recol = 0, rerow = 0;       /* whether to resize columns and rows */
-	int sumw, sumh;
-	int ncols, nrows, nshaded;
-	int x, y, w, h;
-	int b, g, t;                    /* border and gaps for tiled windows */
+	struct Tilecol *cols;
+	struct Tile *tile;
+	struct Tileconf conf;
+	int ncols, ntiles, i;
 
+	if (scanning)                   /* scan() tiles each desktop once at the end */
+		return;
 	mon = desk->mon;
-	b = (config.mergeborders ? (border + 1) / 2 : border);
-	g = (config.mergeborders ? 0 : config.gapinner);
-	t = (config.hidetitle ? 0 : button);
-
-	/* get number of columns and sum their widths with borders and gaps applied */
-	sumw = 0;
-	for (ncols = 0, col = desk->col; col; col = col->next, ncols++)
-		sumw += col->w + b * 2;
-	sumw += g * (ncols - 1);
+	ncols = ntiles = 0;
+	for (col = desk->col; col; col = col->next, ncols++)
+		for (row = col->row; row; row = row->next)
+			ntiles++;
 	if (ncols == 0)
 		return;
 
-	/* decide whether to recalculate columns widths */
-	recol = (sumw != mon->gw);
-
-	w = (mon->gw - g * (ncols - 1) - b * 2 * ncols) / ncols;
-	x = mon->gx;
-	for (col = desk->col; col; col = col->next) {
-		/* the last column gets the remaining width */
-		if (!col->next)
-			w = mon->gw + mon->gx - x - 2 * b;
-
-		/* get number of clients in current column and sum their heights */
-		sumh = 0;
-		for (nshaded = nrows = 0, row = col->row; row; row = row->next, nrows++) {
-			sumh += row->c->h + b * 2 + t;
-			if (row->c->isshaded)
-				nshaded++;
+	/* grow the layout buffers only when needed, as this is called on every motion of a tiled resize */
+	if (ncols > maxtilecols) {
+		maxtilecols = ncols;
+		tilecols = erealloc(tilecols, maxtilecols * sizeof *tilecols);
+	}
+	if (ntiles > maxtiles) {
+		maxtiles = ntiles;
+		tiles = erealloc(tiles, maxtiles * sizeof *tiles);
+	}
+
+	/* copy columns and rows into the layout */
+	cols = tilecols;
+	tile = tiles;
+	for (i = 0, col = desk->col; col; col = col->next, i++) {
+		cols[i].tiles = tile;
+		cols[i].ntiles = 0;
+		cols[i].w = col->w;
+		for (row = col->row; row; row = row->next, tile++) {
+			tile->h = row->h;
+			tile->ch = row->c->h;
+			tile->b = row->c->b;
+			tile->t = row->c->t;
+			tile->isshaded = row->c->isshaded;
+			tile->isfullscreen = row->c->isfullscreen;
+			tile->issingletab = (row->c->ntabs == 1);
+			cols[i].ntiles++;
 		}
-		sumh += g * (nrows - 1);
-
-		/* decide whether to recalculate client heights */
-		rerow = (sumh != mon->gh);
-
-		if (nshaded < nrows)
-			h = (mon->gh - g * (nrows - nshaded) - b * 2 * nrows - t * nrows) / (nrows - nshaded);
-		else
-			h = 0;
-		y = mon->gy;
-
-		for (row = col->row; row; row = row->next) {
-			if (row->c->isfullscreen)
+	}
+	conf.area.x = mon->gx;
+	conf.area.y = mon->gy;
+	conf.area.w = mon->gw;
+	conf.area.h = mon->gh;
+	conf.full.x = mon->wx;
+	conf.full.y = mon->wy;
+	conf.full.w = mon->ww;
+	conf.full.h = mon->wh;
+	conf.b = (config.mergeborders ? (border + 1) / 2 : border);
+	conf.g = (config.mergeborders ? 0 : config.gapinner);
+	conf.t = (config.hidetitle ? 0 : button);
+	conf.ignoregaps = config.ignoregaps;
+	conf.ignoreborders = config.ignoreborders;
+	conf.ignoretitle = config.ignoretitle;
+	layouttile(cols, ncols, &conf);
+
+	/* apply the layout, committing only the windows that changed */
+	tile = tiles;
+	for (i = 0, col = desk->col; col; col = col->next, i++) {
+		col->w = cols[i].w;
+		for (row = col->row; row; row = row->next, tile++) {
+			if (tile->isfullscreen)
 				continue;
-
-			/* the last client gets the remaining height */
-			if (!row->next)
-				h = mon->gh + mon->gy - y - t - 2 * b;
-
-			/* set new width and heights */
-			if (recol || !col->next)
-				col->w = w;
-			if (rerow || !row->next)
-				row->h = h;
-
-			/* if there is only one tiled window, borders or gaps can be ignored */
-			clientborderwidth(row->c, b);
-			if (!row->c->isshaded)
-				clienttitlewidth(row->c, (config.hidetitle ? 0 : button));
-			if (nrows == 1 && ncols == 1) {
-				if (config.ignoreborders) {
-					col->w += 2 * b;
-					row->h += 2 * b - t;
-					clientborderwidth(row->c, 0);
-				}
-				if (config.ignoregaps) {
-					x = mon->wx;
-					y = mon->wy;
-					col->w = mon->ww - ((!config.ignoreborders) ? 2 * b : 0);
-					row->h = mon->wh - ((!config.ignoreborders) ? 2 * b : 0) - t;
-				}
-				if (config.ignoretitle && !row->c->isshaded && row->c->ntabs == 1) {
-					clienttitlewidth(row->c, 0);
-					row->h += t;
-				}
-			}
-
-			if (row->c->isshaded)
-				row->h = 0;
-
-			row->c->x = x + row->c->b;
-			row->c->y = y + row->c->b + row->c->t;
-			row->c->w = col->w;
-			row->c->h = row->h;
-			if (clientisvisible(row->c)) {
+			row->h = tile->h;
+			clientborderwidth(row->c, tile->b);
+			clienttitlewidth(row->c, tile->t);
+			row->c->x = tile->x;
+			row->c->y = tile->y;
+			row->c->w = tile->w;
+			row->c->h = tile->h;
+			if (clientisvisible(row->c) && clientchanged(row->c)) {
 				clientmoveresize(row->c);
 			}
+		}
+	}
+}
+
+/* get an unused column, allocating a chunk of them if needed */
+static struct Column *
+colalloc(void)
+{
+	struct Colchunk *chunk;
+	struct Column *col;
+	int i;
 
-			y += row->h + g + b * 2 + t;
+	if (freecols == NULL) {
+		chunk = emalloc(sizeof *chunk);
+		chunk->next = colchunks;
+		colchunks = chunk;
+		for (i = TILECHUNK - 1; i >= 0; i--) {
+			chunk->cols[i].next = freecols;
+			freecols = &chunk->cols[i];
 		}
+	}
+	col = freecols;
+	freecols = col->next;
+	return col;
+}
+
+/* get an unused row, allocating a chunk of them if needed */
+static struct Row *
+rowalloc(void)
+{
+	struct Rowchunk *chunk;
+	struct Row *row;
+	int i;
 
-		x += col->w + g + b * 2;
+	if (freerows == NULL) {
+		chunk = emalloc(sizeof *chunk);
+		chunk->next = rowchunks;
+		rowchunks = chunk;
+		for (i = TILECHUNK - 1; i >= 0; i--) {
+			chunk->rows[i].next = freerows;
+			freerows = &chunk->rows[i];
+		}
 	}
+	row = freerows;
+	freerows = row->next;
+	return row;
 }
 
 /* allocate column in desktop */
 static struct Column *
 coladd(struct Desktop *desk, int end)
 {
-	struct Column *col, *lastcol;
+	struct Column *col;
 
-	col = emalloc(sizeof *col);
+	col = colalloc();
 	col->desk = desk;
 	col->prev = NULL;
 	col->next = NULL;
 	col->row = NULL;
+	col->lastrow = NULL;
 	col->w = 0;
 	if (desk->col == NULL) {
-		desk->col = col;
+		desk->col = desk->lastcol = col;
 	} else if (end) {
-		for (lastcol = desk->col; lastcol->next; lastcol = lastcol->next)
-			;
-		lastcol->next = col;
-		col->prev = lastcol;
+		desk->lastcol->next = col;
+		col->prev = desk->lastcol;
+		desk->lastcol = col;
 	} else {
-		if (desk->col)
-			desk->col->prev = col;
+		desk->col->prev = col;
 		col->next = desk->col;
 		desk->col = col;
 	}
@@ -1798,32 +2706,34 @@ coldel(struct Column *col)
 {
 	if (col->next)
 		col->next->prev = col->prev;
+	else
+		col->desk->lastcol = col->prev;
 	if (col->prev)
 		col->prev->next = col->next;
 	else
 		col->desk->col = col->next;
-	free(col);
+	col->next = freecols;
+	freecols = col;
 }
 
 /* allocate row in column */
 static struct Row *
 rowadd(struct Column *col)
 {
-	struct Row *row, *lastrow;
+	struct Row *row;
 
-	row = emalloc(sizeof *row);
+	row = rowalloc();
 	row->prev = NULL;
 	row->next = NULL;
 	row->col = col;
 	row->c = None;
 	row->h = 0;
 	if (col->row == NULL) {
-		col->row = row;
+		col->row = col->lastrow = row;
 	} else {
-		for (lastrow = col->row; lastrow->next; lastrow = lastrow->next)
-			;
-		lastrow->next = row;
-		row->prev = lastrow;
+		col->lastrow->next = row;
+		row->prev = col->lastrow;
+		col->lastrow = row;
 	}
 	return row;
 }
@@ -1832,15 +2742,21 @@ rowadd(struct Column *col)
 static void
 rowdel(struct Row *row)
 {
+	struct Column *col;
+
+	col = row->col;
 	if (row->next)
 		row->next->prev = row->prev;
+	else
+		col->lastrow = row->prev;
 	if (row->prev)
 		row->prev->next = row->next;
 	else
-		row->col->row = row->next;
-	if (row->col->row == NULL)
-		coldel(row->col);
-	free(row);
+		col->row = row->next;
+	if (col->row == NULL)
+		coldel(col);
+	row->next = freerows;
+	freerows = row;
 }
 
 /* get the retion position x,y (relative to frame, not the content) is in the frame */
@@ -1854,94 +2770,20 @@ frameregion(struct Client *c, Window win, int x, int y)
 			return FrameTitle;
 	if (win != c->frame)
 		return FrameNone;
-	if (x >= c->b && x < c->b + button && y >= c->b && y < c->b + button)
-		return FrameButtonLeft;
-	if (x >= c->b + c->w - button && x < c->b + c->w && y >= c->b && y < c->b + button)
-		return FrameButtonRight;
-	if (x >= c->b + button && y >= c->b && x < c->b + c->w - button && y < c->b + button)
-		return FrameTitle;
-	if (x < c->b || y < c->b || x >= c->b + c->w || y >= c->b + c->h)
-		return FrameBorder;
-	return FrameNone;
+	return layoutregion(x, y, c->w, c->h, c->b, button);
 }
 
 /* get in which corner or side of window the cursor is in */
 static enum Octant
 frameoctant(struct Client *c, Window win, int x, int y)
 {
-	double tan;
-	int wm, hm;
-	int w, h;
-	int b;
-
 	if (c == NULL || c->state == Minimized)
 		return SE;
 	if (win == c->frame || win == c->curswin) {
 		x -= c->b;
 		y -= c->b + c->t;
 	}
-	w = c->w;
-	h = c->h;
-	b = corner - c->b;
-	if (x >= w - b && y >= h - b)
-		return SE;
-	if (x >= w - b && y <= 0)
-		return NE;
-	if (x <= b && y >= h - b)
-		return SW;
-	if (x <= b && y <= 0)
-		return NW;
-	if (x < 0)
-		return W;
-	if (y < 0)
-		return N;
-	if (x >= w)
-		return E;
-	if (y >= h)
-		return S;
-	wm = w / 2;
-	hm = h / 2;
-	if (c->state == Tiled) {
-		tan = (double)h/w;
-		if (tan == 0.0)
-			tan = 1.0;
-		if (y >= hm) {
-			h = y - hm;
-			w = h / tan;
-			if (x < wm - w) {
-				return W;
-			} if (x > wm + w) {
-				return E;
-			} else {
-				return S;
-			}
-		} else {
-			h = hm - y;
-			w = h / tan;
-			if (x < wm - w) {
-				return W;
-			} if (x > wm + w) {
-				return E;
-			} else {
-				return N;
-			}
-		}
-		return N;
-	} else {
-		if (x >= wm && y >= hm) {
-			return SE;
-		}
-		if (x >= wm && y <= hm) {
-			return NE;
-		}
-		if (x <= wm && y >= hm) {
-			return SW;
-		}
-		if (x <= wm && y <= hm) {
-			return NW;
-		}
-	}
-	return SE;
+	return layoutoctant(x, y, c->w, c->h, corner - c->b, c->state == Tiled);
 }
 
 /* find best position to place a client on screen */
@@ -1950,12 +2792,8 @@ clientplace(struct Client *c, struct Desktop *desk)
 {
 	struct Monitor *mon;
 	struct Client *tmp;
-	int grid[DIV][DIV] = {{0}, {0}};
-	int lowest;
-	int i, j, k, w, h;
-	int subx, suby;         /* position of the larger subregion */
-	int subw, subh;         /* larger subregion width and height */
-	int origw, origh;
+	struct Rect area, sub, *wins;
+	int n, w, h, i;
 
 	if (desk == NULL || c == NULL || c->state == Tiled || c->isfullscreen || c->state == Minimized)
 		return;
@@ -1963,17 +2801,9 @@ clientplace(struct Client *c, struct Desktop *desk)
 	mon = desk->mon;
 
 	/* if window is bigger than monitor, resize it while maintaining proportion */
-	origw = c->fw + 2 * c->b;
-	origh = c->fh + 2 * c->b + c->t;
-	w = min(origw, mon->gw);
-	h = min(origh, mon->gh);
-	if (origw * h > origh * w) {
-		h = (origh * w) / origw;
-		w = (origw * h) / origh;
-	} else {
-		w = (origw * h) / origh;
-		h = (origh * w) / origw;
-	}
+	w = c->fw + 2 * c->b;
+	h = c->fh + 2 * c->b + c->t;
+	layoutfit(&w, &h, mon->gw, mon->gh);
 	c->fw = max(minsize, w - (2 * c->b));
 	c->fh = max(minsize, h - (2 * c->b + c->t));
 
@@ -1981,69 +2811,33 @@ clientplace(struct Client *c, struct Desktop *desk)
 	if (c->isuserplaced)
 		return;
 
-	/* increment cells of grid a window is in */
-	for (tmp = clients; tmp; tmp = tmp->next) {
-		if (tmp != c && ((tmp->state == Sticky && tmp->mon == mon) || (tmp->state == Normal && tmp->desk == desk))) {
-			for (i = 0; i < DIV; i++) {
-				for (j = 0; j < DIV; j++) {
-					int ha, hb, wa, wb;
-					int ya, yb, xa, xb;
-					ha = mon->gy + (mon->gh * i)/DIV;
-					hb = mon->gy + (mon->gh * (i + 1))/DIV;
-					wa = mon->gx + (mon->gw * j)/DIV;
-					wb = mon->gx + (mon->gw * (j + 1))/DIV;
-					ya = tmp->fy;
-					yb = tmp->fy + tmp->fh + 2 * tmp->b + tmp->t;
-					xa = tmp->fx;
-					xb = tmp->fx + tmp->fw + 2 * tmp->b;
-					if (ya <= hb && ha <= yb && xa <= wb && wa <= xb) {
-						if (ya < ha && yb > hb)
-							grid[i][j]++;
-						if (xa < wa && xb > wb)
-							grid[i][j]++;
-						grid[i][j]++;
-					}
-				}
-			}
-		}
-	}
-
-	/* find biggest region in grid with less windows in it */
-	lowest = INT_MAX;
-	subx = suby = 0;
-	subw = subh = 0;
-	for (i = 0; i < DIV; i++) {
-		for (j = 0; j < DIV; j++) {
-			if (grid[i][j] > lowest)
+	/* get the frames of the other floating windows on the desktop and the sticky ones on its monitor */
+	n = 0;
+	for (tmp = mon->sticky; tmp; tmp = tmp->dnext)
+		n++;
+	for (tmp = desk->clients; tmp; tmp = tmp->dnext)
+		n++;
+	wins = ecalloc(max(n, 1), sizeof *wins);
+	n = 0;
+	for (i = 0; i < 2; i++) {
+		for (tmp = (i == 0) ? mon->sticky : desk->clients; tmp; tmp = tmp->dnext) {
+			if (tmp == c || (tmp->state != Sticky && tmp->state != Normal))
 				continue;
-			else if (grid[i][j] < lowest) {
-				lowest = grid[i][j];
-				subw = subh = 0;
-			}
-			for (w = 0; j+w < DIV && grid[i][j + w] == lowest; w++)
-				;
-			for (h = 1; i+h < DIV && grid[i + h][j] == lowest; h++) {
-				for (k = 0; k < w && grid[i + h][j + k] == lowest; k++)
-					;
-				if (k < w)
-					break;
-			}
-			if (k < w)
-				h--;
-			if (w * h > subw * subh) {
-				subw = w;
-				subh = h;
-				suby = i;
-				subx = j;
-			}
+			wins[n].x = tmp->fx;
+			wins[n].y = tmp->fy;
+			wins[n].w = tmp->fw + 2 * tmp->b;
+			wins[n].h = tmp->fh + 2 * tmp->b + tmp->t;
+			n++;
 		}
 	}
-	subx = subx * mon->gw / DIV;
-	suby = suby * mon->gh / DIV;
-	subw = subw * mon->gw / DIV;
-	subh = subh * mon->gh / DIV;
-	c->fx = min(mon->gx + mon->gw - c->fw - c->b, max(mon->gx + c->b, mon->gx + subx + subw / 2 - c->fw / 2));
-	c->fy = min(mon->gy + mon->gh - c->fh - c->b, max(mon->gy + c->t + c->b, mon->gy + suby + subh / 2 - c->fh / 2));
+	area.x = mon->gx;
+	area.y = mon->gy;
+	area.w = mon->gw;
+	area.h = mon->gh;
+	sub = layoutplace(&area, wins, n);
+	free(wins);
+	c->fx = min(mon->gx + mon->gw - c->fw - c->b, max(mon->gx + c->b, sub.x + sub.w / 2 - c->fw / 2));
+	c->fy = min(mon->gy + mon->gh - c->fh - c->b, max(mon->gy + c->t + c->b, sub.y + sub.h / 2 - c->fh / 2));
 }
 
 /* apply size constraints */
@@ -2059,58 +2853,107 @@ clientapplysize(struct Client *c)
 	c->y = c->fy;
 }
 
-/* remove client from the focus list */
+/* get the focus history a client belongs in: its desktop's, or its monitor's if sticky */
+static struct Client **
+clientfocushead(struct Client *c)
+{
+	if (c->state == Sticky && c->mon != NULL)
+		return &c->mon->stickyfocus;
+	if ((c->state == Normal || c->state == Tiled) && c->desk != NULL)
+		return &c->desk->focus;
+	return NULL;
+}
+
+/* remove client from its focus history */
 static void
 clientdelfocus(struct Client *c)
 {
+	if (c->fhead == NULL)
+		return;
 	if (c->fnext) {
 		c->fnext->fprev = c->fprev;
 	}
 	if (c->fprev) {
 		c->fprev->fnext = c->fnext;
-	} else if (focuslist == c) {
-		focuslist = c->fnext;
+	} else {
+		*c->fhead = c->fnext;
 	}
+	c->fprev = c->fnext = NULL;
+	c->fhead = NULL;
 }
 
-/* put client on beginning of focus list */
+/* put client on beginning of its focus history */
 static void
 clientaddfocus(struct Client *c)
 {
-	if (c == NULL || c->state == Minimized)
+	struct Client **head;
+
+	if (c == NULL || (head = clientfocushead(c)) == NULL)
 		return;
 	clientdelfocus(c);
-	c->fnext = focuslist;
+	c->fnext = *head;
 	c->fprev = NULL;
-	if (focuslist)
-		focuslist->fprev = c;
-	focuslist = c;
+	if (*head)
+		(*head)->fprev = c;
+	*head = c;
+	c->fhead = head;
+	c->fseq = ++focusseq;
 }
 
-/* remove client from the raise list */
+/* get the member list a client belongs in: its desktop's, or its monitor's if sticky */
+static struct Client **
+clientmemberhead(struct Client *c)
+{
+	if (c->state == Sticky && c->mon != NULL)
+		return &c->mon->sticky;
+	if ((c->state == Normal || c->state == Tiled) && c->desk != NULL)
+		return &c->desk->clients;
+	return NULL;
+}
+
+/* remove client from its member list */
 static void
-clientdelraise(struct Client *c)
+clientdelmember(struct Client *c)
 {
-	if (c->rnext) {
-		c->rnext->rprev = c->rprev;
+	if (c->dhead == NULL)
+		return;
+	if (c->dnext) {
+		c->dnext->dprev = c->dprev;
 	}
-	if (c->rprev) {
-		c->rprev->rnext = c->rnext;
-	} else if (raiselist == c) {
-		raiselist = c->rnext;
+	if (c->dprev) {
+		c->dprev->dnext = c->dnext;
+	} else {
+		*c->dhead = c->dnext;
 	}
+	c->dprev = c->dnext = NULL;
+	c->dhead = NULL;
 }
 
-/* put client on beginning of raise list */
+/* put client on given member list */
 static void
-clientaddraise(struct Client *c)
+clientaddmember(struct Client *c, struct Client **head)
 {
-	clientdelraise(c);
-	c->rnext = raiselist;
-	c->rprev = NULL;
-	if (raiselist)
-		raiselist->rprev = c;
-	raiselist = c;
+	clientdelmember(c);
+	if (head == NULL)
+		return;
+	c->dnext = *head;
+	c->dprev = NULL;
+	if (*head)
+		(*head)->dprev = c;
+	*head = c;
+	c->dhead = head;
+}
+
+/* move client into the member list and focus history of its new desktop, monitor or state */
+static void
+clientrefocus(struct Client *c)
+{
+	if (c->dhead != clientmemberhead(c))
+		clientaddmember(c, clientmemberhead(c));
+	if (c->fhead == clientfocushead(c))
+		return;
+	clientdelfocus(c);
+	clientaddfocus(c);
 }
 
 /* raise client */
@@ -2121,20 +2964,98 @@ clientraise(struct Client *c)
 
 	if (c == NULL || c->state == Minimized)
 		return;
-	clientaddraise(c);
+	stackraise(c);
+	if (restacking)         /* deskrestack() restacks all frames at once */
+		return;
 	wins[1] = c->frame;
-	if (c->isfullscreen)
-		wins[0] = layerwin[LayerFullscreen];
-	else if (c->state == Tiled)
-		wins[0] = layerwin[LayerTiled];
-	else if (c->layer < 0)
-		wins[0] = layerwin[LayerBelow];
-	else if (c->layer > 0)
-		wins[0] = layerwin[LayerAbove];
-	else
-		wins[0] = layerwin[LayerTop];
-	XRestackWindows(dpy, wins, sizeof wins);
-	ewmhsetclientsstacking();
+	wins[0] = layerwin[clientlayer(c)];
+	XRestackWindows(dpy, wins, sizeof wins / sizeof *wins);
+}
+
+/* free the pixmaps of a hidden client; run as an idle job */
+static void
+clientfreepixmaps(void *p)
+{
+	struct Client *c = p;
+	struct Transient *trans;
+	struct Tab *t;
+
+	if (c->pix != None)
+		XFreePixmap(dpy, c->pix);
+	c->pix = None;
+	c->pw = c->ph = 0;
+	for (t = c->tabs; t; t = t->next) {
+		if (t->pix != None)
+			XFreePixmap(dpy, t->pix);
+		t->pix = None;
+		t->pw = 0;
+		for (trans = t->trans; trans; trans = trans->next) {
+			if (trans->pix != None)
+				XFreePixmap(dpy, trans->pix);
+			trans->pix = None;
+			trans->pw = trans->ph = 0;
+		}
+	}
+}
+
+/* compare clients by stacking order, topmost first, for qsort(3) */
+static int
+clientstackcmp(const void *a, const void *b)
+{
+	const struct Client *ca = *(struct Client *const *)a;
+	const struct Client *cb = *(struct Client *const *)b;
+
+	if (ca->slayer != cb->slayer)
+		return cb->slayer - ca->slayer;
+	return (cb->sseq > ca->sseq) - (cb->sseq < ca->sseq);
+}
+
+/*
+ * Restack with a single request the frames of the clients shown once
+ * desk is the current desktop of its monitor.  The frames shown on the
+ * other monitors are included as well, for every layer's frames to stay
+ * together between the dummy windows of its layer and of the one below.
+ */
+static void
+deskrestack(struct Desktop *desk)
+{
+	struct Monitor *mon;
+	struct Desktop *d;
+	struct Client **cs, *c;
+	Window *wins;
+	int i, n, nwins, layer;
+
+	n = 0;
+	for (mon = mons; mon; mon = mon->next) {
+		d = (mon == desk->mon) ? desk : mon->seldesk;
+		for (c = mon->sticky; c; c = c->dnext)
+			n++;
+		for (c = d->clients; c; c = c->dnext)
+			n++;
+	}
+	cs = ecalloc(n + 1, sizeof *cs);
+	wins = ecalloc(n + LayerLast, sizeof *wins);
+	n = 0;
+	for (mon = mons; mon; mon = mon->next) {
+		d = (mon == desk->mon) ? desk : mon->seldesk;
+		for (c = mon->sticky; c; c = c->dnext)
+			cs[n++] = c;
+		for (c = d->clients; c; c = c->dnext)
+			cs[n++] = c;
+	}
+	qsort(cs, n, sizeof *cs, clientstackcmp);
+
+	/* each layer's frames go below its dummy window, as clientraise() puts them */
+	nwins = 0;
+	for (i = 0, layer = LayerLast - 1; layer >= LayerTiled; layer--) {
+		wins[nwins++] = layerwin[layer];
+		for (; i < n && cs[i]->slayer == layer; i++) {
+			wins[nwins++] = cs[i]->frame;
+		}
+	}
+	XRestackWindows(dpy, wins, nwins);
+	free(wins);
+	free(cs);
 }
 
 /* hide client */
@@ -2146,19 +3067,50 @@ clienthide(struct Client *c, int hide)
 	if (c == NULL)
 		return;
 	c->ishidden = hide;
+	if (c->isparked) {
+		/* the frame is still mapped; unmap it first if hiding, so it does not flash on screen */
+		c->isparked = 0;
+		if (hide)
+			XUnmapWindow(dpy, c->frame);
+		XMoveWindow(dpy, c->frame, c->cx - c->cb, c->cy - c->cb - c->ct);
+		if (!hide) {
+			if (idledel(clientdecorateidle, c))
+				clientdraw(c, 1, 0, FrameNone);
+			return;
+		}
+	}
 	if (hide) {
 		XUnmapWindow(dpy, c->frame);
 		for (t = c->tabs; t; t = t->next) {
 			icccmwmstate(t->win, IconicState);
 		}
+		idleadd(IdlePixmap, clientfreepixmaps, c);
 	} else {
+		idledel(clientfreepixmaps, c);
+		if (idledel(clientdecorateidle, c) || c->pix == None)
+			clientdraw(c, 1, 0, FrameNone);
 		XMapWindow(dpy, c->frame);
 		for (t = c->tabs; t; t = t->next) {
-			icccmwmstate(t->win, NormalState);
+			if (!t->ishidden) {
+				icccmwmstate(t->win, NormalState);
+			}
 		}
 	}
 }
 
+/* hide client of a desktop not being shown, moving it off screen if configured to */
+static void
+clientpark(struct Client *c)
+{
+	if (!config.parkdesktops || c->ishidden) {
+		clienthide(c, 1);
+		return;
+	}
+	c->ishidden = 1;
+	c->isparked = 1;
+	XMoveWindow(dpy, c->frame, clientparkx(c), c->cy - c->cb - c->ct);
+}
+
 /* hide all windows and show the desktop */
 static void
 clientshowdesk(int show)
@@ -2166,13 +3118,14 @@ clientshowdesk(int show)
 	struct Client *c;
 
 	showingdesk = show;
-	for (c = clients; c; c = c->next) {
-		if (c->state != Minimized &&
-		   ((c->state == Sticky && c->mon == selmon) ||
-		   (c->state != Sticky && c->desk == selmon->seldesk))) {
-			clienthide(c, show);
-		}
-	}
+	XGrabServer(dpy);
+	if (!show)
+		deskrestack(selmon->seldesk);
+	for (c = selmon->sticky; c; c = c->dnext)
+		clienthide(c, show);
+	for (c = selmon->seldesk->clients; c; c = c->dnext)
+		clienthide(c, show);
+	XUngrabServer(dpy);
 	ewmhsetshowingdesktop(show);
 }
 
@@ -2184,13 +3137,18 @@ clientsendtodesk(struct Client *c, struct Desktop *desk, int place)
 		return;
 	c->desk = desk;
 	c->mon = desk->mon;
+	clientrefocus(c);
 	if (place) {
 		clientplace(c, c->desk);
 		clientapplysize(c);
 		if (clientisvisible(c)) {
 			clientmoveresize(c);
 		}
-		clienthide(c, !clientisvisible(c));
+		if (clientisvisible(c)) {
+			clienthide(c, 0);
+		} else {
+			clientpark(c);
+		}
 	}
 	clientraise(c);
 	ewmhsetwmdesktop(c);
@@ -2203,6 +3161,7 @@ clientstick(struct Client *c, int stick)
 	if (stick != REMOVE && c->state != Sticky) {
 		c->state = Sticky;
 		c->desk = NULL;
+		clientrefocus(c);
 	} else if (stick != ADD && c->state == Sticky) {
 		c->state = Normal;
 		clientsendtodesk(c, c->mon->seldesk, 0);
@@ -2226,8 +3185,7 @@ clienttile(struct Client *c, int tile)
 		if (desk->col == NULL || desk->col->next == NULL) {
 			col = coladd(desk, 1);
 		} else {
-			for (col = desk->col; col->next; col = col->next)
-				;
+			col = desk->lastcol;
 		}
 		row = rowadd(col);
 		row->c = c;
@@ -2265,6 +3223,7 @@ clientminimize(struct Client *c, int minimize)
 		c->desk = NULL;
 		c->mon = NULL;
 		c->state = Minimized;
+		clientrefocus(c);
 		clienthide(c, 1);
 	} else if (minimize != ADD && c->state == Minimized) {
 		c->state = Normal;
@@ -2397,6 +3356,45 @@ clientfocus(struct Client *c)
 	return 1;
 }
 
+/* change size of the column and row of tiled client and of their neighbours; return whether to retile */
+static int
+tileresize(struct Client *c, enum Octant o, int x, int y)
+{
+	if (o & N && c->row->prev) {
+		if (c->row->prev->h - y < minsize)
+			y = c->row->prev->h - minsize;
+		if (c->row->h + y < minsize)
+			return 0;
+		c->row->h += y;
+		c->row->prev->h -= y;
+	}
+	if (o & S && c->row->next) {
+		if (c->row->next->h - y < minsize)
+			y = c->row->next->h - minsize;
+		if (c->row->h + y < minsize)
+			return 0;
+		c->row->h += y;
+		c->row->next->h -= y;
+	}
+	if (o & W && c->row->col->prev) {
+		if (c->row->col->prev->w - x < minsize)
+			x = c->row->col->prev->w - minsize;
+		if (c->row->col->w + x < minsize)
+			return 0;
+		c->row->col->w += x;
+		c->row->col->prev->w -= x;
+	}
+	if (o & E && c->row->col->next) {
+		if (c->row->col->next->w - x < minsize)
+			x = c->row->col->next->w - minsize;
+		if (c->row->col->w + x < minsize)
+			return 0;
+		c->row->col->w += x;
+		c->row->col->next->w -= x;
+	}
+	return 1;
+}
+
 /* resize client x and y pixels out of octant o */
 static void
 clientincrresize(struct Client *c, enum Octant o, int x, int y)
@@ -2406,39 +3404,9 @@ clientincrresize(struct Client *c, enum Octant o, int x, int y)
 	if (c == NULL || c->state == Minimized || c->isfullscreen)
 		return;
 	if (c->state == Tiled) {
-		if (o & N && c->row->prev) {
-			if (c->row->prev->h - y < minsize)
-				y = c->row->prev->h - minsize;
-			if (c->row->h + y < minsize)
-				return;
-			c->row->h += y;
-			c->row->prev->h -= y;
-		}
-		if (o & S && c->row->next) {
-			if (c->row->next->h - y < minsize)
-				y = c->row->next->h - minsize;
-			if (c->row->h + y < minsize)
-				return;
-			c->row->h += y;
-			c->row->next->h -= y;
-		}
-		if (o & W && c->row->col->prev) {
-			if (c->row->col->prev->w - x < minsize)
-				x = c->row->col->prev->w - minsize;
-			if (c->row->col->w + x < minsize)
-				return;
-			c->row->col->w += x;
-			c->row->col->prev->w -= x;
-		}
-		if (o & E && c->row->col->next) {
-			if (c->row->col->next->w - x < minsize)
-				x = c->row->col->next->w - minsize;
-			if (c->row->col->w + x < minsize)
-				return;
-			c->row->col->w += x;
-			c->row->col->next->w -= x;
+		if (tileresize(c, o, x, y)) {
+			desktile(c->desk);      /* commits only the neighbours that changed */
 		}
-		desktile(c->desk);
 	} else {
 		if (c->fw + x < minsize || c->fh + y < minsize)
 			return;
@@ -2523,7 +3491,7 @@ clientincrmove(struct Client *c, int x, int y)
 		c->fy += y;
 		c->x = c->fx;
 		c->y = c->fy;
-		clientmoveresize(c);
+		clientmove(c);
 		if (c->state != Sticky) {
 			monto = getmon(c->fx + c->fw / 2, c->fy + c->fh / 2);
 			if (monto && monto != c->mon) {
@@ -2541,7 +3509,10 @@ clientadd(int x, int y, int w, int h, int isuserplaced)
 
 	c = emalloc(sizeof *c);
 	c->fprev = c->fnext = NULL;
-	c->rprev = c->rnext = NULL;
+	c->fhead = NULL;
+	c->fseq = 0;
+	c->dprev = c->dnext = NULL;
+	c->dhead = NULL;
 	c->mon = NULL;
 	c->desk = NULL;
 	c->row = NULL;
@@ -2549,9 +3520,11 @@ clientadd(int x, int y, int w, int h, int isuserplaced)
 	c->isuserplaced = isuserplaced;
 	c->isshaded = 0;
 	c->ishidden = 0;
+	c->isparked = 0;
 	c->state = Normal;
 	c->layer = 0;
 	c->pw = c->ph = 0;
+	c->cx = c->cy = c->cw = c->ch = c->cb = c->ct = -1;
 	c->x = c->fx = x;
 	c->y = c->fy = y;
 	c->w = c->fw = w;
@@ -2570,10 +3543,13 @@ clientadd(int x, int y, int w, int h, int isuserplaced)
 	                         CWEventMask, &clientswa);
 	c->curswin = XCreateWindow(dpy, c->frame, 0, 0, c->w + c->b * 2, c->h + c->b * 2 + c->t, 0,
 	                           CopyFromParent, InputOnly, CopyFromParent, 0, NULL);
+	winmapadd(c->frame, NULL, c, NULL, NULL);
+	winmapadd(c->curswin, NULL, c, NULL, NULL);
 	if (clients)
 		clients->prev = c;
 	c->next = clients;
 	clients = c;
+	stacklink(c);
 	XMapWindow(dpy, c->curswin);
 	return c;
 }
@@ -2582,8 +3558,9 @@ clientadd(int x, int y, int w, int h, int isuserplaced)
 static void
 clientdel(struct Client *c)
 {
+	idledelarg(c);
 	clientdelfocus(c);
-	clientdelraise(c);
+	clientdelmember(c);
 	if (focused == c)
 		focused = NULL;
 	if (raised == c)
@@ -2594,6 +3571,7 @@ clientdel(struct Client *c)
 		c->prev->next = c->next;
 	else
 		clients = c->next;
+	stackunlink(c);
 	if (c->state == Tiled) {
 		rowdel(c->row);
 	}
@@ -2603,6 +3581,8 @@ clientdel(struct Client *c)
 		tabdel(c->tabs);
 	if (c->pix != None)
 		XFreePixmap(dpy, c->pix);
+	winmapdel(c->frame);
+	winmapdel(c->curswin);
 	XDestroyWindow(dpy, c->frame);
 	XDestroyWindow(dpy, c->curswin);
 	free(c);
@@ -2654,29 +3634,29 @@ clientvalidsize(struct Client *c, enum Octant o, int dx, int dy)
 		if (c->state == Tiled) {
 			if (o & N) {
 				return c->row->prev &&
-				       c->row->prev->h - dy >= minsize &&
-				       c->row->h + dy >= minsize;
+				       layoutvalidsize(c->row->prev->h, -dy, minsize) &&
+				       layoutvalidsize(c->row->h, dy, minsize);
 			} else if (o & S) {
 				return c->row->next &&
-				       c->row->next->h - dy >= minsize &&
-				       c->row->h + dy >= minsize;
+				       layoutvalidsize(c->row->next->h, -dy, minsize) &&
+				       layoutvalidsize(c->row->h, dy, minsize);
 			}
 		} else {
-			return c->h + dy >= minsize;
+			return layoutvalidsize(c->h, dy, minsize);
 		}
 	} else if (dx != 0) {
 		if (c->state == Tiled) {
 			if (o & W) {
 				return c->row->col->prev &&
-				       c->row->col->prev->w - dx >= minsize &&
-				       c->row->col->w + dx >= minsize;
+				       layoutvalidsize(c->row->col->prev->w, -dx, minsize) &&
+				       layoutvalidsize(c->row->col->w, dx, minsize);
 			} else if (o & E) {
 				return c->row->col->next &&
-				       c->row->col->next->w - dx >= minsize &&
-				       c->row->col->w + dx >= minsize;
+				       layoutvalidsize(c->row->col->next->w, -dx, minsize) &&
+				       layoutvalidsize(c->row->col->w, dx, minsize);
 			}
 		} else {
-			return c->w + dx >= minsize;
+			return layoutvalidsize(c->w, dx, minsize);
 		}
 	}
 	return 0;
@@ -2794,13 +3774,14 @@ clienttab(struct Client *c, struct Tab *t, int pos)
 		t->title = XCreateWindow(dpy, c->frame, c->b + button + t->x, c->b, t->w, button, 0,
 		                         CopyFromParent, CopyFromParent, CopyFromParent,
 		                         CWEventMask, &clientswa);
+		winmapadd(t->title, NULL, NULL, t, NULL);
 	} else {
 		XReparentWindow(dpy, t->title, c->frame, c->b, c->b);
 	}
 	XReparentWindow(dpy, t->frame, c->frame, c->b, c->b + c->t);
 	XMapWindow(dpy, t->title);
-	XMapWindow(dpy, t->frame);
 	XMapSubwindows(dpy, t->frame);
+	clientretab(c);
 	if (oldc) {     /* deal with the frame this tab came from */
 		if (oldc->ntabs == 0) {
 			clientdel(oldc);
@@ -2828,23 +3809,28 @@ deskchange(struct Desktop *desk)
 	if (desk == NULL || desk == selmon->seldesk)
 		return;
 	if (!deskisvisible(desk)) {
+		/* switch desktops atomically, so no intermediate state is drawn */
+		XGrabServer(dpy);
+
 		/* hide clients of previous current desktop */
-		for (c = clients; c; c = c->next) {
-			if (c->desk == desk->mon->seldesk) {
-				clienthide(c, 1);
-			}
+		for (c = desk->mon->seldesk->clients; c; c = c->dnext) {
+			clientpark(c);
 		}
+		desk->mon->seldesk = desk;
 
-		/* unhide clientsof new current desktop */
-		for (c = clients; c; c = c->next) {
-			if (c->desk == desk) {
-				if (!c->isfullscreen && c->state == Normal) {
-					clientapplysize(c);
-					clientmoveresize(c);
-				}
-				clienthide(c, 0);
+		/* move, tile and restack clients of new current desktop before mapping them */
+		for (c = desk->clients; c; c = c->dnext) {
+			if (!c->isfullscreen && c->state == Normal) {
+				clientapplysize(c);
+				clientmoveresize(c);
 			}
 		}
+		desktile(desk);
+		deskrestack(desk);
+		for (c = desk->clients; c; c = c->dnext) {
+			clienthide(c, 0);
+		}
+		XUngrabServer(dpy);
 	}
 
 	/* if changing focus to a new monitor and the cursor isn't there, warp it */
@@ -2860,7 +3846,6 @@ deskchange(struct Desktop *desk)
 	if (showingdesk)
 		clientshowdesk(0);
 	ewmhsetcurrentdesktop(desk->n);
-	desktile(desk);
 
 	/* focus client on the new current desktop */
 	clientstate(getnextfocused(NULL), FOCUS, ADD);
@@ -2931,6 +3916,18 @@ tabwindow(const char *class, int autotab)
 	return 0;
 }
 
+/* update tab title and redraw it; called by the timer set by xeventpropertynotify */
+static void
+tabtitletimeout(void *arg)
+{
+	struct Tab *t;
+
+	t = (struct Tab *)arg;
+	t->titletimer = NULL;
+	tabupdatetitle(t);
+	clientdecorate(t->c, 1, 0, FrameNone);
+}
+
 /* update tab urgency */
 static void
 tabupdateurgency(struct Tab *t, int isurgent)
@@ -2955,6 +3952,8 @@ decorate(struct Winres *res)
 
 	if (res->n) {
 		XCopyArea(dpy, res->n->pix, res->n->frame, gc, 0, 0, res->n->w, res->n->h, 0, 0);
+	} else if (res->trans && res->trans->pix == None) {
+		transdecorate(res->trans);      /* pixmap freed while its client was hidden */
 	} else if (res->trans) {
 		fullw = res->trans->w + 2 * border;
 		fullh = res->trans->h + 2 * border;
@@ -3000,34 +3999,6 @@ preparewin(Window win)
 	XSetWindowBorderWidth(dpy, win, 0);
 }
 
-/* check if event is related to the prompt or its frame */
-static Bool
-promptvalidevent(Display *dpy, XEvent *ev, XPointer arg)
-{
-	struct Prompt *prompt;
-
-	(void)dpy;
-	prompt = (struct Prompt *)arg;
-	switch(ev->type) {
-	case DestroyNotify:
-		if (ev->xdestroywindow.window == prompt->win)
-			return True;
-		break;
-	case UnmapNotify:
-		if (ev->xunmap.window == prompt->win)
-			return True;
-		break;
-	case ConfigureRequest:
-		if (ev->xconfigurerequest.window == prompt->win)
-			return True;
-		break;
-	case Expose:
-	case ButtonPress:
-		return True;
-	}
-	return False;
-}
-
 /* decorate prompt frame */
 static void
 promptdecorate(Window frame, int w, int h)
@@ -3076,36 +4047,34 @@ promptcalcgeom(int *x, int *y, int *w, int *h, int *fw, int *fh)
 	*fh = *h + border;
 }
 
-/* get tab given window is a transient for */
-static struct Tab *
-gettransfor(Window win)
+/* resize prompt and its frame */
+static void
+promptconfigure(int w, int h)
 {
-	struct Winres res;
-	Window tmpwin;
+	int x, y, fw, fh;
 
-	if (XGetTransientForHint(dpy, win, &tmpwin)) {
-		res = getwin(tmpwin);
-		return res.t;
-	}
-	return NULL;
+	promptcalcgeom(&x, &y, &w, &h, &fw, &fh);
+	prompt->w = w;
+	prompt->h = h;
+	XMoveResizeWindow(dpy, prompt->frame, x, y, fw, fh);
+	XMoveResizeWindow(dpy, prompt->win, border, 0, w, h);
+}
+
+/* remove prompt frame and revert focus to previously focused window */
+static void
+promptdel(void)
+{
+	XReparentWindow(dpy, prompt->win, root, 0, 0);
+	XDestroyWindow(dpy, prompt->frame);
+	free(prompt);
+	prompt = NULL;
+	clientstate(focused, FOCUS, ADD);
 }
 
-/* get window role, class, name, etc and return window rules */
+/* get window rules from window role, class, name, etc */
 static struct Rules
-getrules(Window win, char **name, char **class)
+getrules(struct Winprops *props)
 {
-	static char *prefixes[LAST_PREFIX] = {
-		[TITLE] = "shod.title.",
-		[INSTANCE] = "shod.instance.",
-		[CLASS] = "shod.class.",
-		[ROLE] = "shod.role.",
-	};
-	static char *suffixes[LAST_SUFFIX] = {
-		[DESKTOP] = ".desktop",
-		[STATE] = ".state",
-		[AUTOTAB] = ".autoTab",
-		[POSITION] = ".position",
-	};
 	struct Rules rules = {
 		.desk = -1,
 		.state = Normal,
@@ -3115,106 +4084,30 @@ getrules(Window win, char **name, char **class)
 		.w = -1,
 		.h = -1
 	};
-	XClassHint chint;
-	XrmValue xval;
-	Atom ad;
-	size_t len;
-	unsigned long ld;
-	long n;
-	int i, j, id;
-	unsigned char *p;
-	char *s, *t;
-	char *type;
+	struct Rules *r;
+	char *keys[LAST_PREFIX];
+	int i;
 
-	*class = *name = NULL;
+	keys[TITLE] = props->name;
+	keys[INSTANCE] = props->instance;
+	keys[CLASS] = props->class;
+	keys[ROLE] = props->role;
 	for (i = 0; i < LAST_PREFIX; i++) {
-		switch (i) {
-		case TITLE:
-			if ((*name = getwinname(win)) == NULL)
-				continue;
-			t = *name;
-			break;
-		case INSTANCE:
-			if (!XGetClassHint(dpy, win, &chint))
-				continue;
-			t = chint.res_name;
-			XFree(chint.res_class);
-			break;
-		case CLASS:
-			if (!XGetClassHint(dpy, win, &chint))
-				continue;
-			t = chint.res_class;
-			*class = (t != NULL && *t != '\0') ? estrndup(t, NAMEMAXLEN) : NULL;
-			XFree(chint.res_name);
-			break;
-		case ROLE:
-			if (XGetWindowProperty(dpy, win, atoms[WMWindowRole], 0, NAMEMAXLEN, False,
-			                       XA_STRING, &ad, &id, &ld, &ld, &p) != Success)
-				continue;
-			t = (char *)p;
-			break;
-		default:
-			errx(1, "getrules");
-			break;
-		}
-		if (t == NULL || *t == '\0')
+		if (keys[i] == NULL || *keys[i] == '\0')
 			continue;
-		len = strlen(t) + RULEMINSIZ;
-		s = emalloc(len);
-		for (j = 0; j < LAST_SUFFIX; j++) {
-			if (j == DESKTOP && rules.desk > -1)
-				continue;
-			else if (j == STATE && rules.state != Normal)
-				continue;
-			else if (j == AUTOTAB && rules.autotab != NoAutoTab)
-				continue;
-			else if (j == POSITION && rules.x > -1)
-				continue;
-			snprintf(s, len, "%s%s%s", prefixes[i], t, suffixes[j]);
-			if (XrmGetResource(xdb, s, "*", &type, &xval) != True)
-				continue;
-			switch (j) {
-			case DESKTOP:
-				if ((n = strtol(xval.addr, NULL, 10)) > 0 && n <= config.ndesktops)
-					rules.desk = n - 1;
-				break;
-			case STATE:
-				if (strcasecmp(xval.addr, "sticky") == 0)
-					rules.state = Sticky;
-				else if (strcasecmp(xval.addr, "tiled") == 0)
-					rules.state = Tiled;
-				else if (strcasecmp(xval.addr, "minimized") == 0)
-					rules.state = Minimized;
-				break;
-			case AUTOTAB:
-				if (strcasecmp(xval.addr, "floating") == 0)
-					rules.autotab = TabFloating;
-				else if (strcasecmp(xval.addr, "tilingAlways") == 0)
-					rules.autotab = TabTilingAlways;
-				else if (strcasecmp(xval.addr, "tilingMulti") == 0)
-					rules.autotab = TabTilingMulti;
-				else if (strcasecmp(xval.addr, "always") == 0)
-					rules.autotab = TabAlways;
-				break;
-			case POSITION:
-				// TODO
-				break;
-			default:
-				errx(1, "getrules");
-				break;
-			}
-		}
-		free(s);
-		switch (i) {
-		case TITLE:
-			break;
-		case INSTANCE:
-		case CLASS:
-			XFree(t);
-			break;
-		case ROLE:
-			XFree(p);
-			break;
+		if ((r = rulesfind(&ruletabs[i], keys[i])) == NULL)
+			continue;
+		if (rules.desk == -1)
+			rules.desk = r->desk;
+		if (rules.state == Normal)
+			rules.state = r->state;
+		if (rules.autotab == NoAutoTab)
+			rules.autotab = r->autotab;
+		if (rules.x == -1) {
+			rules.x = r->x;
+			rules.y = r->y;
+			rules.w = r->w;
+			rules.h = r->h;
 		}
 	}
 	return rules;
@@ -3240,6 +4133,8 @@ notifadd(Window win, int w, int h)
 	n->frame = XCreateWindow(dpy, root, 0, 0, 1, 1, 0,
 	                         CopyFromParent, CopyFromParent, CopyFromParent,
 	                         CWEventMask, &swa);
+	winmapadd(n->win, n, NULL, NULL, NULL);
+	winmapadd(n->frame, n, NULL, NULL, NULL);
 	if (notifications)
 		notifications->prev = n;
 	notifications = n;
@@ -3375,6 +4270,8 @@ notifdel(struct Notification *n)
 		notifications = n->next;
 	if (n->pix != None)
 		XFreePixmap(dpy, n->pix);
+	winmapdel(n->win);
+	winmapdel(n->frame);
 	XDestroyWindow(dpy, n->frame);
 	free(n);
 	notifplace();
@@ -3388,58 +4285,28 @@ managenotif(Window win, int w, int h)
 	notifplace();
 }
 
-/* map prompt, give it focus, wait for it to close, then revert focus to previously focused window */
+/* map prompt and give it focus; the prompt is removed when its window is unmapped */
 static void
 manageprompt(Window win, int w, int h)
 {
-	struct Prompt prompt;
-	struct Winres res;
-	XEvent ev;
 	int x, y, fw, fh;
 
+	if (prompt != NULL) {
+		windowclose(prompt->win);
+		promptdel();
+	}
 	promptcalcgeom(&x, &y, &w, &h, &fw, &fh);
-	prompt.frame = XCreateWindow(dpy, root, x, y, fw, fh, 0,
-	                             CopyFromParent, CopyFromParent, CopyFromParent,
-	                             CWEventMask, &clientswa);
-	XReparentWindow(dpy, win, prompt.frame, border, 0);
+	prompt = emalloc(sizeof *prompt);
+	prompt->win = win;
+	prompt->w = w;
+	prompt->h = h;
+	prompt->frame = XCreateWindow(dpy, root, x, y, fw, fh, 0,
+	                              CopyFromParent, CopyFromParent, CopyFromParent,
+	                              CWEventMask, &clientswa);
+	XReparentWindow(dpy, win, prompt->frame, border, 0);
 	XMapWindow(dpy, win);
-	XMapWindow(dpy, prompt.frame);
+	XMapWindow(dpy, prompt->frame);
 	XSetInputFocus(dpy, win, RevertToParent, CurrentTime);
-	prompt.win = win;
-	while (!XIfEvent(dpy, &ev, promptvalidevent, (XPointer)&prompt)) {
-		switch(ev.type) {
-		case Expose:
-			if (ev.xexpose.count == 0) {
-				if (ev.xexpose.window == prompt.frame) {
-					promptdecorate(prompt.frame, w, h);
-				} else {
-					res = getwin(ev.xexpose.window);
-					decorate(&res);
-				}
-			}
-			break;
-		case DestroyNotify:
-		case UnmapNotify:
-			goto done;
-			break;
-		case ConfigureRequest:
-			w = ev.xconfigurerequest.width;
-			h = ev.xconfigurerequest.height;
-			promptcalcgeom(&x, &y, &w, &h, &fw, &fh);
-			XMoveResizeWindow(dpy, prompt.frame, x, y, fw, fh);
-			XMoveResizeWindow(dpy, win, border, 0, w, h);
-			break;
-		case ButtonPress:
-			if (ev.xbutton.window != win && ev.xbutton.window != prompt.frame)
-				windowclose(win);
-			XAllowEvents(dpy, ReplayPointer, CurrentTime);
-			break;
-		}
-	}
-done:
-	XReparentWindow(dpy, win, root, 0, 0);
-	XDestroyWindow(dpy, prompt.frame);
-	clientstate(focused, FOCUS, ADD);
 }
 
 /* create client for tab */
@@ -3477,7 +4344,7 @@ manageclient(struct Client *c, struct Tab *t, struct Rules *rules, struct Deskto
 		clientmoveresize(c);
 		clienthide(c, 0);
 	}
-	if (focus) {
+	if (focus && prompt == NULL) {      /* do not take the focus from the prompt */
 		clientstate(c, FOCUS, ADD);
 	} else {
 		clientdecorate(c, 1, 0, FrameNone);
@@ -3503,6 +4370,7 @@ managetrans(struct Tab *t, Window win, int maxw, int maxh, int ignoreunmap)
 	trans->h = 0;
 	trans->pix = None;
 	trans->pw = trans->ph = 0;
+	trans->nx = trans->ny = trans->nw = trans->nh = -1;
 	trans->maxw = maxw;
 	trans->maxh = maxh;
 	trans->ignoreunmap = ignoreunmap;
@@ -3510,6 +4378,8 @@ managetrans(struct Tab *t, Window win, int maxw, int maxh, int ignoreunmap)
 	                             CopyFromParent, CopyFromParent, CopyFromParent,
 	                             CWEventMask, &clientswa);
 	trans->win = win;
+	winmapadd(trans->win, NULL, NULL, NULL, trans);
+	winmapadd(trans->frame, NULL, NULL, NULL, trans);
 	XReparentWindow(dpy, trans->frame, t->frame, 0, 0);
 	XReparentWindow(dpy, trans->win, trans->frame, 0, 0);
 	if (t->trans)
@@ -3517,6 +4387,8 @@ managetrans(struct Tab *t, Window win, int maxw, int maxh, int ignoreunmap)
 	trans->next = t->trans;
 	t->trans = trans;
 	icccmwmstate(win, NormalState);
+	ewmhaddclient(win);
+	ewmhsetclientsstacking();
 	if (clientisvisible(t->c)) {
 		clientdecorate(t->c, 1, 0, FrameNone);
 		clientmoveresize(t->c);
@@ -3532,7 +4404,7 @@ managedesktop(Window win)
 {
 	Window wins[2] = {win, layerwin[LayerDesktop]};
 
-	XRestackWindows(dpy, wins, sizeof wins);
+	XRestackWindows(dpy, wins, sizeof wins / sizeof *wins);
 	XMapWindow(dpy, win);
 }
 
@@ -3542,37 +4414,13 @@ managedock(Window win)
 {
 	Window wins[2] = {win, layerwin[LayerBars]};
 
-	XRestackWindows(dpy, wins, sizeof wins);
+	XRestackWindows(dpy, wins, sizeof wins / sizeof *wins);
 	XMapWindow(dpy, win);
 }
 
-/* delete tab (and its client if it is the only tab) */
-static void
-unmanage(struct Tab *t)
-{
-	struct Client *c, *f;
-
-	c = t->c;
-	tabdel(t);
-	calctabs(c);
-	if (c->ntabs == 0) {
-		f = getnextfocused(c);
-		c->isfullscreen = 0;    /* clientfocus would refuse to focus f if c is fullscreen */
-		if (clientisvisible(c))
-			clientstate(f, FOCUS, ADD);
-		clientdel(c);
-	} else {
-		clientdecorate(c, 1, 0, FrameNone);
-		clientmoveresize(c);
-		if (c == focused) {
-			tabfocus(c->seltab);
-		}
-	}
-}
-
 /* call one of the manage- functions */
 static void
-manage(Window win, XWindowAttributes *wa, int ignoreunmap)
+manage(Window win, XWindowAttributes *wa, struct Winprops *props, int ignoreunmap)
 {
 	struct Winres res;
 	struct Client *c;
@@ -3580,14 +4428,12 @@ manage(Window win, XWindowAttributes *wa, int ignoreunmap)
 	struct Tab *transfor;
 	struct Rules rules;
 	Atom prop;
-	int placed;
-	char *name, *class;
 
 	res = getwin(win);
 	if (res.c != NULL)
 		return;
-	prop = getatomprop(win, atoms[NetWMWindowType]);
-	transfor = gettransfor(win);
+	prop = props->type;
+	transfor = (props->transfor != None) ? getwin(props->transfor).t : NULL;
 	if (prop == atoms[NetWMWindowTypeDesktop]) {
 		managedesktop(win);
 	} else if (prop == atoms[NetWMWindowTypeDock]) {
@@ -3603,10 +4449,11 @@ manage(Window win, XWindowAttributes *wa, int ignoreunmap)
 		managetrans(transfor, win, wa->width, wa->height, ignoreunmap);
 	} else {
 		preparewin(win);
-		placed = isuserplaced(win);
-		rules = getrules(win, &name, &class);
-		t = tabadd(win, name, class, ignoreunmap);
-		if (!placed && tabwindow(class, rules.autotab)) {
+		rules = getrules(props);
+		t = tabadd(win, props->name, props->class, props->isurgent, ignoreunmap);
+		t->synccounter = props->synccounter;
+		props->name = props->class = NULL;      /* now owned by the tab */
+		if (!props->isuserplaced && tabwindow(t->class, rules.autotab)) {
 			clienttab(focused, t, -1);
 			clientdecorate(focused, 1, 0, FrameNone);
 			clientmoveresize(focused);
@@ -3614,7 +4461,7 @@ manage(Window win, XWindowAttributes *wa, int ignoreunmap)
 				desktile(focused->desk);
 			ewmhsetwmdesktop(focused);
 		} else {
-			c = clientadd(wa->x, wa->y, wa->width, wa->height, placed);
+			c = clientadd(wa->x, wa->y, wa->width, wa->height, props->isuserplaced);
 			manageclient(c, t, &rules, (rules.desk >= 0 ? &selmon->desks[rules.desk] : selmon->seldesk));
 		}
 	}
@@ -3624,31 +4471,100 @@ manage(Window win, XWindowAttributes *wa, int ignoreunmap)
 static void
 scan(void)
 {
-	unsigned int i, num;
-	Window d1, d2, transwin, *wins = NULL;
-	XWindowAttributes wa;
+	xcb_query_tree_cookie_t qcookie;
+	xcb_query_tree_reply_t *qreply;
+	xcb_get_window_attributes_cookie_t *acookies;
+	xcb_get_window_attributes_reply_t *areply;
+	xcb_get_geometry_cookie_t *gcookies;
+	xcb_get_geometry_reply_t *greply;
+	xcb_get_property_cookie_t *scookies;
+	xcb_get_property_reply_t *sreply;
+	struct Propcookies *pcookies;
+	struct Winprops *props;
+	struct Monitor *mon;
+	struct Client *c;
+	XWindowAttributes *was;
+	xcb_window_t *wins;
+	int *order;
+	int i, num, nnormal, ntrans, manageable;
 
-	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
-		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
-				continue;
-			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState) {
-				manage(wins[i], &wa, IGNOREUNMAP);
-			}
-		}
-		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
-				continue;
-			if (XGetTransientForHint(dpy, wins[i], &transwin) &&
-			   (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)) {
-				manage(wins[i], &wa, IGNOREUNMAP);
+	qcookie = xcb_query_tree(xcb, root);
+	if ((qreply = xcb_query_tree_reply(xcb, qcookie, NULL)) == NULL)
+		return;
+	wins = xcb_query_tree_children(qreply);
+	num = xcb_query_tree_children_length(qreply);
+
+	/* send all requests for all windows before waiting for any reply */
+	acookies = ecalloc(num, sizeof *acookies);
+	gcookies = ecalloc(num, sizeof *gcookies);
+	scookies = ecalloc(num, sizeof *scookies);
+	pcookies = ecalloc(num, sizeof *pcookies);
+	for (i = 0; i < num; i++) {
+		acookies[i] = xcb_get_window_attributes(xcb, wins[i]);
+		gcookies[i] = xcb_get_geometry(xcb, wins[i]);
+		scookies[i] = xcb_get_property(xcb, 0, wins[i], atoms[WMState], atoms[WMState], 0, 2);
+		propsrequest(wins[i], &pcookies[i]);
+	}
+
+	/* collect replies, placing normal windows before transient ones */
+	props = ecalloc(num, sizeof *props);
+	was = ecalloc(num, sizeof *was);
+	order = ecalloc(num, sizeof *order);
+	nnormal = ntrans = 0;
+	for (i = 0; i < num; i++) {
+		areply = xcb_get_window_attributes_reply(xcb, acookies[i], NULL);
+		greply = xcb_get_geometry_reply(xcb, gcookies[i], NULL);
+		sreply = xcb_get_property_reply(xcb, scookies[i], NULL);
+		manageable = (areply != NULL && greply != NULL && !areply->override_redirect &&
+		              (areply->map_state == XCB_MAP_STATE_VIEWABLE ||
+		               (sreply != NULL && xcb_get_property_value_length(sreply) > 0 &&
+		                *(uint32_t *)xcb_get_property_value(sreply) == IconicState)));
+		if (manageable) {
+			was[i].x = greply->x;
+			was[i].y = greply->y;
+			was[i].width = greply->width;
+			was[i].height = greply->height;
+			was[i].map_state = areply->map_state;
+			was[i].override_redirect = areply->override_redirect;
+			propsreply(&pcookies[i], &props[i]);
+			if (props[i].transfor == None) {
+				order[nnormal++] = i;
+			} else {
+				order[num - ++ntrans] = i;
 			}
+		} else {
+			propsdiscard(&pcookies[i]);
 		}
-		if (wins) {
-			XFree(wins);
-		}
-	}
+		free(areply);
+		free(greply);
+		free(sreply);
+	}
+
+	/* manage windows, deferring tiling and decoration until all of them are managed */
+	scanning = 1;
+	for (i = 0; i < nnormal; i++)
+		manage(wins[order[i]], &was[order[i]], &props[order[i]], IGNOREUNMAP);
+	for (i = num - 1; i >= num - ntrans; i--)
+		manage(wins[order[i]], &was[order[i]], &props[order[i]], IGNOREUNMAP);
+	scanning = 0;
+	for (mon = mons; mon; mon = mon->next)
+		for (i = 0; i < config.ndesktops; i++)
+			desktile(&mon->desks[i]);
+	for (c = clients; c; c = c->next)
+		clientdecorate(c, 1, 0, FrameNone);
+
+	for (i = 0; i < nnormal; i++)
+		freeprops(&props[order[i]]);
+	for (i = num - 1; i >= num - ntrans; i--)
+		freeprops(&props[order[i]]);
+	free(acookies);
+	free(gcookies);
+	free(scookies);
+	free(pcookies);
+	free(props);
+	free(was);
+	free(order);
+	free(qreply);
 }
 
 /* map and hide focus window */
@@ -3746,6 +4662,8 @@ monadd(XineramaScreenInfo *info)
 	mon->gh = mon->wh - config.gapouter * 2;
 	mon->desks = desksadd(mon);
 	mon->seldesk = &mon->desks[0];
+	mon->stickyfocus = NULL;
+	mon->sticky = NULL;
 	if (lastmon) {
 		lastmon->next = mon;
 		mon->prev = lastmon;
@@ -3755,11 +4673,21 @@ monadd(XineramaScreenInfo *info)
 	lastmon = mon;
 }
 
-/* delete monitor and set monitor of clients on it to NULL */
+/* detach client from a deleted monitor, putting it on the orphans list if given */
 static void
-mondel(struct Monitor *mon)
+clientorphan(struct Client *c, struct Client **orphans)
 {
-	struct Client *c;
+	clientdelfocus(c);
+	clientaddmember(c, orphans);
+	c->mon = NULL;
+	c->desk = NULL;
+}
+
+/* delete monitor and detach the clients on it */
+static void
+mondel(struct Monitor *mon, struct Client **orphans)
+{
+	int i;
 
 	if (mon->next)
 		mon->next->prev = mon->prev;
@@ -3769,12 +4697,11 @@ mondel(struct Monitor *mon)
 		mon->prev->next = mon->next;
 	else
 		mons = mon->next;
-	for (c = clients; c; c = c->next) {
-		if (c->mon == mon) {
-			c->mon = NULL;
-			c->desk = NULL;
-		}
-	}
+	while (mon->sticky)
+		clientorphan(mon->sticky, orphans);
+	for (i = 0; i < config.ndesktops; i++)
+		while (mon->desks[i].clients)
+			clientorphan(mon->desks[i].clients, orphans);
 	free(mon->desks);
 	free(mon);
 }
@@ -3788,6 +4715,7 @@ monupdate(void)
 	struct Monitor *mon;
 	struct Monitor *tmp;
 	struct Client *c, *focus;
+	struct Client *orphans = NULL;  /* clients of deleted monitors */
 	int delselmon = 0;
 	int del, add;
 	int i, j, n;
@@ -3819,7 +4747,7 @@ monupdate(void)
 		if (del) {
 			if (tmp == selmon)
 				delselmon = 1;
-			mondel(tmp);
+			mondel(tmp, &orphans);
 		}
 	}
 
@@ -3846,13 +4774,19 @@ monupdate(void)
 
 	/* send clients with do not belong to a window to selected desktop */
 	focus = NULL;
-	for (c = clients; c; c = c->next) {
-		if (c->state != Minimized && c->mon == NULL) {
+	if (orphans != NULL) {
+		XGrabServer(dpy);
+		restacking = 1;
+		while ((c = orphans) != NULL) {
+			clientdelmember(c);
 			c->state = Normal;
 			c->layer = 0;
 			focus = c;
 			clientsendtodesk(c, selmon->seldesk, 1);
 		}
+		restacking = 0;
+		deskrestack(selmon->seldesk);
+		XUngrabServer(dpy);
 	}
 	if (focus != NULL)              /* if a client changed desktop, focus it */
 		clientstate(focus, FOCUS, ADD);
@@ -3860,33 +4794,28 @@ monupdate(void)
 	free(unique);
 }
 
-/* press button with mouse */
+/* press button with mouse; the button is released in mousebuttonend() */
 static void
 mousebutton(struct Client *c, int region)
 {
-	struct Winres res;
-	XEvent ev;
-	int released = region;
-
 	XGrabPointer(dpy, c->frame, False, ButtonReleaseMask, GrabModeAsync, GrabModeAsync, None,
 	             (region == FrameButtonRight) ? cursor[CURSOR_PIRATE] : cursor[CURSOR_NORMAL], CurrentTime);
 	clientdecorate(c, 0, 0, region);     /* draw pressed button */
-	while (!XMaskEvent(dpy, ButtonReleaseMask | ExposureMask, &ev)) {
-		switch(ev.type) {
-		case Expose:
-			if (ev.xexpose.count == 0) {
-				res = getwin(ev.xexpose.window);
-				decorate(&res);
-			}
-			break;
-		case ButtonRelease:
-			released = frameregion(c, ev.xbutton.window, ev.xbutton.x, ev.xbutton.y);
-			goto done;
-		}
-	}
-done:
-	clientdecorate(c, 0, 0, FrameNone);  /* draw pressed button */
-	if (released == region) {
+	drag.type = DragButton;
+	drag.c = c;
+	drag.t = NULL;
+	drag.region = region;
+}
+
+/* release button pressed with mouse over the given region */
+static void
+mousebuttonend(int released)
+{
+	struct Client *c;
+
+	c = drag.c;
+	clientdecorate(c, 0, 0, FrameNone);  /* draw unpressed button */
+	if (released == drag.region) {
 		switch (released) {
 		case FrameButtonLeft:
 			clientstate(c, HIDE, ADD);
@@ -3897,46 +4826,41 @@ done:
 			break;
 		}
 	}
-	XUngrabPointer(dpy, CurrentTime);
 }
 
-/* detach tab from window with mouse */
+/* detach tab from window with mouse; the tab is dropped in mouseretabend() */
 static void
 mouseretab(struct Tab *t, int xroot, int yroot, int x, int y)
 {
-	struct Monitor *mon;
-	struct Client *c;
-	struct Winres res;
-	XEvent ev;
-	int pos;
-
 	tabdetach(t, xroot - x, yroot - y);
 	tabfocus(t->c->seltab);
 	clientretab(t->c);
 	XGrabPointer(dpy, t->title, False, ButtonReleaseMask | Button3MotionMask, GrabModeAsync, GrabModeAsync, None, cursor[CURSOR_NORMAL], CurrentTime);
-	while (!XMaskEvent(dpy, ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ExposureMask, &ev)) {
-		switch(ev.type) {
-		case Expose:
-			if (ev.xexpose.count == 0) {
-				if (ev.xexpose.window == t->title || (t->trans && ev.xexpose.window == t->trans->frame)) {
-					tabdecorate(t, FrameNone);
-				} else {
-					res = getwin(ev.xexpose.window);
-					decorate(&res);
-				}
-			}
-			break;
-		case ButtonRelease:
-			xroot = ev.xbutton.x_root;
-			yroot = ev.xbutton.y_root;
-			XUnmapWindow(dpy, t->title);
-			goto done;
-		case MotionNotify:
-			tabmove(t, ev.xmotion.x_root - x, ev.xmotion.y_root - y);
-			break;
-		}
-	}
-done:
+	drag.type = DragRetab;
+	drag.c = t->c;
+	drag.t = t;
+	drag.x = x;
+	drag.y = y;
+}
+
+/* move detached tab with mouse */
+static void
+mouseretabmotion(int xroot, int yroot)
+{
+	tabmove(drag.t, xroot - drag.x, yroot - drag.y);
+}
+
+/* drop detached tab into the client below the cursor or into a new client */
+static void
+mouseretabend(int xroot, int yroot)
+{
+	struct Monitor *mon;
+	struct Client *c;
+	struct Tab *t;
+	int pos;
+
+	t = drag.t;
+	XUnmapWindow(dpy, t->title);
 	if ((c = getclientbytitle(xroot, yroot, &pos)) != NULL) {
 		clienttab(c, t, pos);
 	} else {
@@ -3944,87 +4868,103 @@ done:
 		c = clientadd(xroot, yroot, t->winw, t->winh, 0);
 		manageclient(c, t, NULL, mon->seldesk);
 	}
-	clientretab(c);
-	clientdecorate(c, 1, 0, FrameNone);
-	XUngrabPointer(dpy, CurrentTime);
-	ewmhsetwmdesktop(c);
+	clientretab(c);
+	clientdecorate(c, 1, 0, FrameNone);
+	ewmhsetwmdesktop(c);
+}
+
+/* move frame with mouse; the frame is moved in mousemovemotion() */
+static void
+mousemove(struct Client *c, struct Tab *t, int xroot, int yroot, enum Octant octant, int region)
+{
+	XGrabPointer(dpy, c->frame, False,
+	             ButtonReleaseMask | Button1MotionMask | Button3MotionMask,
+	             GrabModeAsync, GrabModeAsync, None, cursor[CURSOR_MOVE], CurrentTime);
+	if (t != NULL && region == FrameTitle)
+		tabdecorate(t, region);
+	else
+		clientdecorate(c, 0, octant, region);
+	drag.type = DragMove;
+	drag.c = c;
+	drag.t = t;
+	drag.xroot = xroot;
+	drag.yroot = yroot;
+}
+
+/* move frame to follow the cursor */
+static void
+mousemovemotion(int xroot, int yroot)
+{
+	struct Client *c;
+	int x, y;
+
+	c = drag.c;
+	if (c->state == Tiled) {
+		if (xroot > c->x + c->w + (c->row->col->next ? c->b + config.gapinner : 0))
+			x = +1;
+		else if (xroot < c->x - (c->row->col->prev ? c->b + config.gapinner : 0))
+			x = -1;
+		else
+			x = 0;
+		if (c->row->next && yroot > c->y + c->h + HEIGHT(c->row->next->c) / 2 + config.gapinner)
+			y = +1;
+		else if (c->row->prev && yroot < c->y - HEIGHT(c->row->prev->c) / 2)
+			y = -1;
+		else
+			y = 0;
+	} else {
+		x = xroot - drag.xroot;
+		y = yroot - drag.yroot;
+	}
+	clientincrmove(c, x, y);
+}
+
+/* get the size changed when resizing client: the floating size, or the size of the column and row */
+static void
+mouseresizesize(struct Client *c, int *w, int *h)
+{
+	if (c->state == Tiled) {
+		*w = c->row->col->w;
+		*h = c->row->h;
+	} else {
+		*w = c->fw;
+		*h = c->fh;
+	}
 }
 
-/* move frame with mouse */
+/* get how much of the resize outline has not been applied to the client yet */
 static void
-mousemove(struct Client *c, struct Tab *t, int xroot, int yroot, enum Octant octant, int region)
+mouseresizepending(int *x, int *y)
 {
-	struct Winres res;
-	XEvent ev;
-	int x = 0, y = 0;
+	int w, h;
 
-	XGrabPointer(dpy, c->frame, False,
-	             ButtonReleaseMask | Button1MotionMask | Button3MotionMask,
-	             GrabModeAsync, GrabModeAsync, None, cursor[CURSOR_MOVE], CurrentTime);
-	if (t != NULL && region == FrameTitle)
-		tabdecorate(t, region);
-	else
-		clientdecorate(c, 0, octant, region);
-	while (!XMaskEvent(dpy, ButtonPressMask | ButtonReleaseMask | PointerMotionMask | ExposureMask, &ev)) {
-		switch(ev.type) {
-		case Expose:
-			if (ev.xexpose.count == 0) {
-				res = getwin(ev.xexpose.window);
-				decorate(&res);
-			}
-			break;
-		case ButtonRelease:
-			goto done;
-		case MotionNotify:
-			if (c->state == Tiled) {
-				if (ev.xmotion.x_root > c->x + c->w + (c->row->col->next ? c->b + config.gapinner : 0))
-					x = +1;
-				else if (ev.xmotion.x_root < c->x - (c->row->col->prev ? c->b + config.gapinner : 0))
-					x = -1;
-				else
-					x = 0;
-				if (c->row->next && ev.xmotion.y_root > c->y + c->h + HEIGHT(c->row->next->c) / 2 + config.gapinner)
-					y = +1;
-				else if (c->row->prev && ev.xmotion.y_root < c->y - HEIGHT(c->row->prev->c) / 2)
-					y = -1;
-				else
-					y = 0;
-			} else {
-				x = ev.xmotion.x_root - xroot;
-				y = ev.xmotion.y_root - yroot;
-			}
-			clientincrmove(c, x, y);
-			xroot = ev.xmotion.x_root;
-			yroot = ev.xmotion.y_root;
-			break;
-		}
+	if (!drag.live) {
+		*x = drag.outline.diffx;
+		*y = drag.outline.diffy;
+		return;
 	}
-done:
-	clientdecorate(c, 1, 0, FrameNone);          /* draw pressed region */
-	XUngrabPointer(dpy, CurrentTime);
+	mouseresizesize(drag.c, &w, &h);
+	*x = drag.outline.diffx - (w - drag.startw);
+	*y = drag.c->isshaded ? 0 : drag.outline.diffy - (h - drag.starth);
 }
 
-/* resize frame with mouse */
+/* resize frame with mouse; the outline is drawn in mouseresizemotion() */
 static void
 mouseresize(struct Client *c, int xroot, int yroot, enum Octant octant)
 {
-	struct Outline outline;
-	struct Winres res;
-	XEvent ev;
 	Cursor curs = None;
-	int x, y, dx, dy;
 
 	if (c->isfullscreen || (c->state == Tiled &&
 	    ((c->row->col->next == NULL && octant & E) || (c->row->col->prev == NULL && octant & W) ||
 	     (c->row->prev == NULL && octant & N) || (c->row->next == NULL && octant & S)))) {
 		return;
 	}
-	outline.x = c->x - c->b;
-	outline.y = c->y - c->b - c->t;
-	outline.w = WIDTH(c);
-	outline.h = HEIGHT(c);
-	outline.diffx = 0;
-	outline.diffy = 0;
+	drag.outline.x = c->x - c->b;
+	drag.outline.y = c->y - c->b - c->t;
+	drag.outline.w = WIDTH(c);
+	drag.outline.h = HEIGHT(c);
+	drag.outline.diffx = 0;
+	drag.outline.diffy = 0;
 	switch (octant) {
 	case NW:
 		curs = c->isshaded ? cursor[CURSOR_W] : cursor[CURSOR_NW];
@@ -4054,85 +4994,301 @@ mouseresize(struct Client *c, int xroot, int yroot, enum Octant octant)
 		curs = cursor[CURSOR_NORMAL];
 	}
 	if (octant & W)
-		x = xroot - c->x + c->b;
+		drag.x = xroot - c->x + c->b;
 	else if (octant & E)
-		x = c->x + c->w + c->b - xroot;
+		drag.x = c->x + c->w + c->b - xroot;
 	else
-		x = 0;
+		drag.x = 0;
 	if (octant & N)
-		y = yroot - c->y + c->b + c->t;
+		drag.y = yroot - c->y + c->b + c->t;
 	else if (octant & S)
-		y = c->y + c->h + c->b - yroot;
+		drag.y = c->y + c->h + c->b - yroot;
 	else
-		y = 0;
+		drag.y = 0;
 	XGrabPointer(dpy, c->frame, False,
 	             ButtonReleaseMask | PointerMotionMask,
 	             GrabModeAsync, GrabModeAsync, None, curs, CurrentTime);
 	clientdecorate(c, 0, octant, FrameNone);     /* draw pressed region */
-	while (!XMaskEvent(dpy, ButtonReleaseMask | PointerMotionMask | ExposureMask, &ev)) {
-		switch(ev.type) {
-		case Expose:
-			if (ev.xexpose.count == 0) {
-				res = getwin(ev.xexpose.window);
-				decorate(&res);
-			}
-			break;
-		case ButtonRelease:
-			goto done;
-		case MotionNotify:
-			if (x > outline.w)
-				x = 0;
-			if (y > outline.h)
-				y = 0;
-			if (octant & W &&
-			    ((ev.xmotion.x_root < xroot && x > ev.xmotion.x_root - outline.x) ||
-			     (ev.xmotion.x_root > xroot && x < ev.xmotion.x_root - outline.x))) {
-				dx = xroot - ev.xmotion.x_root;
-				if (clientvalidsize(c, octant, outline.diffx + dx, 0)) {
-					outline.x -= dx;
-					outline.w += dx;
-					outline.diffx += dx;
-				}
-			} else if (octant & E &&
-			    ((ev.xmotion.x_root > xroot && x > outline.x + outline.w - ev.xmotion.x_root) ||
-			     (ev.xmotion.x_root < xroot && x < outline.x + outline.w - ev.xmotion.x_root))) {
-				dx = ev.xmotion.x_root - xroot;
-				if (clientvalidsize(c, octant, outline.diffx + dx, 0)) {
-					outline.w += dx;
-					outline.diffx += dx;
-				}
-			}
-			if (octant & N &&
-			    ((ev.xmotion.y_root < yroot && y > ev.xmotion.y_root - outline.y) ||
-			     (ev.xmotion.y_root > yroot && y < ev.xmotion.y_root - outline.y))) {
-				dy = yroot - ev.xmotion.y_root;
-				if (clientvalidsize(c, octant, 0, outline.diffy + dy)) {
-					outline.y -= dy;
-					outline.h += dy;
-					outline.diffy += dy;
-				}
-			} else if (octant & S &&
-			    ((ev.xmotion.y_root > yroot && outline.y + outline.h - ev.xmotion.y_root < y) ||
-			     (ev.xmotion.y_root < yroot && outline.y + outline.h - ev.xmotion.y_root > y))) {
-				dy = ev.xmotion.y_root - yroot;
-				if (clientvalidsize(c, octant, 0, outline.diffy + dy)) {
-					outline.h += dy;
-					outline.diffy += dy;
-				}
-			}
-			outlinedraw(&outline);
-			xroot = ev.xmotion.x_root;
-			yroot = ev.xmotion.y_root;
-			break;
+	drag.type = DragResize;
+	drag.c = c;
+	drag.t = NULL;
+	drag.octant = octant;
+	drag.xroot = xroot;
+	drag.yroot = yroot;
+	drag.live = config.liveresize || c->state == Tiled;
+	mouseresizesize(c, &drag.startw, &drag.starth);
+	drag.syncwaiting = 0;
+	drag.lastresize = 0;
+	drag.resizetimer = NULL;
+}
+
+/* read the sync counter of a tab and its value again, after the client recreated or reset it */
+static void
+tabsyncreset(struct Tab *t)
+{
+	unsigned long *values;
+	XSyncValue value;
+
+	if (!hassync || t == NULL)
+		return;
+	if ((values = getcardinalprop(t->win, atoms[NetWMSyncRequestCounter], 1)) == NULL) {
+		t->synccounter = None;
+		return;
+	}
+	t->synccounter = *values;
+	XFree(values);
+	if (XSyncQueryCounter(dpy, t->synccounter, &value))
+		t->syncvalue = ((long long)XSyncValueHigh32(value) << 32) | XSyncValueLow32(value);
+	else
+		t->synccounter = None;
+}
+
+/* ask client to update its sync counter after handling the next resize; return whether it was asked */
+static int
+tabsyncrequest(struct Tab *t)
+{
+	XSyncAlarmAttributes aa;
+	XSyncValue value;
+	XEvent ev;
+
+	if (!hassync || t == NULL || t->synccounter == None)
+		return 0;
+	t->syncvalue++;
+	XSyncIntsToValue(&value, (unsigned int)(t->syncvalue & 0xFFFFFFFF), (int)(t->syncvalue >> 32));
+	ev.type = ClientMessage;
+	ev.xclient.window = t->win;
+	ev.xclient.message_type = atoms[WMProtocols];
+	ev.xclient.format = 32;
+	ev.xclient.data.l[0] = atoms[NetWMSyncRequest];
+	ev.xclient.data.l[1] = CurrentTime;
+	ev.xclient.data.l[2] = XSyncValueLow32(value);
+	ev.xclient.data.l[3] = XSyncValueHigh32(value);
+	ev.xclient.data.l[4] = 0;
+	XSendEvent(dpy, t->win, False, NoEventMask, &ev);
+	aa.trigger.counter = t->synccounter;
+	aa.trigger.value_type = XSyncAbsolute;
+	aa.trigger.wait_value = value;
+	aa.trigger.test_type = XSyncPositiveComparison;
+	aa.events = True;
+	if (drag.alarm == None)
+		drag.alarm = XSyncCreateAlarm(dpy, XSyncCACounter | XSyncCAValueType | XSyncCAValue | XSyncCATestType | XSyncCAEvents, &aa);
+	else
+		XSyncChangeAlarm(dpy, drag.alarm, XSyncCACounter | XSyncCAValueType | XSyncCAValue | XSyncCATestType | XSyncCAEvents, &aa);
+	return 1;
+}
+
+/*
+ * Resize frame to the outline, unless the client is still handling the
+ * last resize.  This is also the callback of the resize timer, which
+ * runs after the frame rate delay or after the client failed to
+ * acknowledge the last resize in time.  Tiled clients retile their
+ * desktop, which commits only the columns or rows sharing the border
+ * being dragged.
+ */
+static void
+mouseresizelive(void *timer)
+{
+	struct Client *c;
+	long long now;
+	long delay;
+	int x, y;
+
+	c = drag.c;
+	if (timer != NULL) {
+		/* the client did not acknowledge the last resize; its counter may have been reset */
+		if (drag.syncwaiting)
+			tabsyncreset(c->seltab);
+		drag.resizetimer = NULL;
+		drag.syncwaiting = 0;
+	}
+	if (drag.syncwaiting || drag.resizetimer != NULL)
+		return;
+	mouseresizepending(&x, &y);
+	if (x == 0 && y == 0)
+		return;
+	if (c->state != Tiled && (c->fw + x < minsize || c->fh + y < minsize))
+		return;
+	now = timenow();
+	if (c->state != Tiled && tabsyncrequest(c->seltab)) {
+		drag.syncwaiting = 1;
+		drag.resizetimer = timeradd(SYNCTIMEOUT, 0, mouseresizelive, &drag);
+	} else if ((delay = 1000 / config.resizerate - (now - drag.lastresize)) > 0) {
+		drag.resizetimer = timeradd(delay, 0, mouseresizelive, &drag);
+		return;
+	}
+	drag.lastresize = now;
+	clientincrresize(c, drag.octant, x, y);
+}
+
+/* update resize outline to follow the cursor */
+static void
+mouseresizemotion(int xroot, int yroot)
+{
+	struct Outline *outline;
+	struct Client *c;
+	enum Octant octant;
+	int dx, dy;
+	int px, py;             /* part of the outline not applied to the client yet */
+
+	c = drag.c;
+	octant = drag.octant;
+	outline = &drag.outline;
+	mouseresizepending(&px, &py);
+	if (drag.x > outline->w)
+		drag.x = 0;
+	if (drag.y > outline->h)
+		drag.y = 0;
+	if (octant & W &&
+	    ((xroot < drag.xroot && drag.x > xroot - outline->x) ||
+	     (xroot > drag.xroot && drag.x < xroot - outline->x))) {
+		dx = drag.xroot - xroot;
+		if (clientvalidsize(c, octant, px + dx, 0)) {
+			outline->x -= dx;
+			outline->w += dx;
+			outline->diffx += dx;
+		}
+	} else if (octant & E &&
+	    ((xroot > drag.xroot && drag.x > outline->x + outline->w - xroot) ||
+	     (xroot < drag.xroot && drag.x < outline->x + outline->w - xroot))) {
+		dx = xroot - drag.xroot;
+		if (clientvalidsize(c, octant, px + dx, 0)) {
+			outline->w += dx;
+			outline->diffx += dx;
 		}
 	}
-done:
-	clientincrresize(c, octant, outline.diffx, outline.diffy);
-	outlinedraw(&(struct Outline){0, 0, 0, 0, 0, 0});
-	clientdecorate(c, 1, 0, FrameNone);          /* draw pressed region */
+	if (octant & N &&
+	    ((yroot < drag.yroot && drag.y > yroot - outline->y) ||
+	     (yroot > drag.yroot && drag.y < yroot - outline->y))) {
+		dy = drag.yroot - yroot;
+		if (clientvalidsize(c, octant, 0, py + dy)) {
+			outline->y -= dy;
+			outline->h += dy;
+			outline->diffy += dy;
+		}
+	} else if (octant & S &&
+	    ((yroot > drag.yroot && outline->y + outline->h - yroot < drag.y) ||
+	     (yroot < drag.yroot && outline->y + outline->h - yroot > drag.y))) {
+		dy = yroot - drag.yroot;
+		if (clientvalidsize(c, octant, 0, py + dy)) {
+			outline->h += dy;
+			outline->diffy += dy;
+		}
+	}
+	if (drag.live) {
+		mouseresizelive(NULL);
+	} else {
+		outlinedraw(outline);
+	}
+}
+
+/* resize frame to the outline */
+static void
+mouseresizeend(void)
+{
+	struct Client *c;
+	int x, y;
+
+	c = drag.c;
+	mouseresizepending(&x, &y);
+	if (drag.live) {
+		if (drag.resizetimer != NULL)
+			timerdel(drag.resizetimer);
+		if (drag.alarm != None)
+			XSyncDestroyAlarm(dpy, drag.alarm);
+		drag.resizetimer = NULL;
+		drag.alarm = None;
+		drag.syncwaiting = 0;
+	} else {
+		outlinedraw(&(struct Outline){0, 0, 0, 0, 0, 0});
+	}
+	clientincrresize(c, drag.octant, x, y);
+	clientdecorate(c, 1, 0, FrameNone);          /* draw unpressed region */
+}
+
+/* handle the last pointer motion since the previous call */
+static void
+dragmotion(void)
+{
+	if (!drag.motion)
+		return;
+	drag.motion = 0;
+	switch (drag.type) {
+	case DragRetab:
+		mouseretabmotion(drag.motionx, drag.motiony);
+		break;
+	case DragMove:
+		mousemovemotion(drag.motionx, drag.motiony);
+		break;
+	case DragResize:
+		mouseresizemotion(drag.motionx, drag.motiony);
+		break;
+	default:
+		break;
+	}
+	drag.xroot = drag.motionx;
+	drag.yroot = drag.motiony;
+}
+
+/* end operation performed with the mouse; ev is NULL if the operation is interrupted */
+static void
+dragend(XButtonEvent *ev)
+{
+	enum DragType type;
+
+	dragmotion();
+	type = drag.type;
+	drag.type = DragNone;
+	switch (type) {
+	case DragButton:
+		mousebuttonend(ev != NULL ? frameregion(drag.c, ev->window, ev->x, ev->y) : FrameNone);
+		break;
+	case DragRetab:
+		if (ev != NULL)
+			mouseretabend(ev->x_root, ev->y_root);
+		else
+			mouseretabend(drag.xroot, drag.yroot);
+		break;
+	case DragMove:
+		clientdecorate(drag.c, 1, 0, FrameNone);     /* draw unpressed region */
+		break;
+	case DragResize:
+		mouseresizeend();
+		break;
+	default:
+		return;
+	}
+	drag.c = NULL;
+	drag.t = NULL;
 	XUngrabPointer(dpy, CurrentTime);
 }
 
+/* delete tab (and its client if it is the only tab) */
+static void
+unmanage(struct Tab *t)
+{
+	struct Client *c, *f;
+
+	/* finish the operation on this tab or on its client before they are gone */
+	if (drag.type != DragNone && (drag.t == t || drag.c == t->c))
+		dragend(NULL);
+	c = t->c;
+	tabdel(t);
+	calctabs(c);
+	if (c->ntabs == 0) {
+		f = getnextfocused(c);
+		c->isfullscreen = 0;    /* clientfocus would refuse to focus f if c is fullscreen */
+		if (clientisvisible(c))
+			clientstate(f, FOCUS, ADD);
+		clientdel(c);
+	} else {
+		clientdecorate(c, 1, 0, FrameNone);
+		clientmoveresize(c);
+		if (c == focused) {
+			tabfocus(c->seltab);
+		}
+	}
+}
+
 /* handle mouse operation, focusing and raising */
 static void
 xeventbuttonpress(XEvent *e)
@@ -4147,6 +5303,17 @@ xeventbuttonpress(XEvent *e)
 	enum Octant octant;
 	int region;
 
+	/* clicking outside the prompt closes it */
+	if (prompt != NULL) {
+		if (ev->window != prompt->win && ev->window != prompt->frame)
+			windowclose(prompt->win);
+		goto done;
+	}
+
+	/* other buttons are ignored while an operation is performed with the mouse */
+	if (drag.type != DragNone)
+		goto done;
+
 	res = getwin(ev->window);
 	c = res.c;
 	t = res.t;
@@ -4210,6 +5377,31 @@ done:
 	XAllowEvents(dpy, ReplayPointer, CurrentTime);
 }
 
+/* resize again when the client acknowledges the last resize */
+static void
+xeventalarmnotify(XEvent *e)
+{
+	XSyncAlarmNotifyEvent *ev = (XSyncAlarmNotifyEvent *)e;
+
+	if (drag.type != DragResize || !drag.syncwaiting || ev->alarm != drag.alarm)
+		return;
+	if (ev->state != XSyncAlarmActive || XSyncValueLessThan(ev->counter_value, ev->alarm_value))
+		tabsyncreset(drag.c->seltab);   /* the counter was destroyed or went back */
+	if (drag.resizetimer != NULL)
+		timerdel(drag.resizetimer);
+	drag.resizetimer = NULL;
+	drag.syncwaiting = 0;
+	mouseresizelive(NULL);
+}
+
+/* end operation performed with the mouse */
+static void
+xeventbuttonrelease(XEvent *e)
+{
+	if (drag.type != DragNone)
+		dragend(&e->xbutton);
+}
+
 /* handle client message event */
 static void
 xeventclientmessage(XEvent *e)
@@ -4223,6 +5415,11 @@ xeventclientmessage(XEvent *e)
 	int i;
 
 	res = getwin(ev->window);
+	if (drag.type == DragRetab && res.t != NULL && res.t == drag.t) {
+		/* the dragged tab is out of its client; drop it before handling the request */
+		dragend(NULL);
+		res = getwin(ev->window);
+	}
 	c = res.c;
 	if (ev->message_type == atoms[NetCurrentDesktop]) {
 		deskchange(getdesk(ev->data.l[0]));
@@ -4323,10 +5520,13 @@ xeventclientmessage(XEvent *e)
 		 */
 		if (c == NULL)
 			return;
+		if (ev->data.l[2] == MOVERESIZE_CANCEL) {
+			dragend(NULL);
+			return;
+		}
+		if (drag.type != DragNone)      /* do not start an operation over another */
+			return;
 		switch (ev->data.l[2]) {
-		case MOVERESIZE_CANCEL:
-			XUngrabPointer(dpy, CurrentTime);
-			break;
 		case MOVERESIZE_SIZE_TOPLEFT:
 			mouseresize(c, ev->data.l[0], ev->data.l[1], NW);
 			break;
@@ -4383,6 +5583,10 @@ xeventconfigurerequest(XEvent *e)
 	XWindowChanges wc;
 	struct Winres res;
 
+	if (prompt != NULL && ev->window == prompt->win) {
+		promptconfigure(ev->width, ev->height);
+		return;
+	}
 	wc.x = ev->x;
 	wc.y = ev->y;
 	wc.width = ev->width;
@@ -4391,10 +5595,19 @@ xeventconfigurerequest(XEvent *e)
 	wc.sibling = ev->above;
 	wc.stack_mode = ev->detail;
 	res = getwin(ev->window);
+
+	/* a client must be notified even if its request changes nothing */
 	if (res.trans != NULL) {
+		res.trans->nw = -1;
 		transconfigure(res.trans, ev->value_mask, &wc);
+		clientnotify(res.trans->t->c);
 	} else if (res.c != NULL) {
+		if (res.t != NULL && !res.t->ishidden)
+			res.t->nw = -1;
 		clientconfigure(res.c, ev->value_mask, &wc);
+		clientnotify(res.c);
+		if (res.t != NULL && res.t->ishidden)
+			tabnotifyhidden(res.t);
 	} else if (res.c == NULL){
 		XConfigureWindow(dpy, ev->window, ev->value_mask, &wc);
 	}
@@ -4407,6 +5620,10 @@ xeventdestroynotify(XEvent *e)
 	XDestroyWindowEvent *ev = &e->xdestroywindow;
 	struct Winres res;
 
+	if (prompt != NULL && ev->window == prompt->win) {
+		promptdel();
+		return;
+	}
 	res = getwin(ev->window);
 	if (res.n && ev->window == res.n->win) {
 		notifdel(res.n);
@@ -4428,7 +5645,7 @@ xevententernotify(XEvent *e)
 {
 	struct Winres res;
 
-	if (config.focusbuttons)
+	if (config.focusbuttons || prompt != NULL || drag.type != DragNone)
 		return;
 	while (XCheckTypedEvent(dpy, EnterNotify, e))
 		;
@@ -4445,7 +5662,14 @@ xeventexpose(XEvent *e)
 	XExposeEvent *ev = &e->xexpose;
 	struct Winres res;
 
-	if (ev->count == 0) {
+	if (ev->count != 0)
+		return;
+	if (prompt != NULL && ev->window == prompt->frame) {
+		promptdecorate(prompt->frame, prompt->w, prompt->h);
+	} else if (drag.type == DragRetab && (ev->window == drag.t->title ||
+	           (drag.t->trans && ev->window == drag.t->trans->frame))) {
+		tabdecorate(drag.t, FrameNone);
+	} else {
 		res = getwin(ev->window);
 		decorate(&res);
 	}
@@ -4458,6 +5682,11 @@ xeventfocusin(XEvent *e)
 	XFocusChangeEvent *ev = &e->xfocus;
 	struct Winres res;
 
+	if (prompt != NULL) {   /* the prompt keeps the focus while it is shown */
+		if (ev->window != prompt->win && ev->window != prompt->frame)
+			XSetInputFocus(dpy, prompt->win, RevertToParent, CurrentTime);
+		return;
+	}
 	res = getwin(ev->window);
 	if (focused == NULL || focused != res.c) {
 		clientstate(focused, FOCUS, ADD);
@@ -4481,12 +5710,15 @@ xeventmaprequest(XEvent *e)
 {
 	XMapRequestEvent *ev = &e->xmaprequest;
 	XWindowAttributes wa;
+	struct Winprops props;
 
 	if (!XGetWindowAttributes(dpy, ev->window, &wa))
 		return;
 	if (wa.override_redirect)
 		return;
-	manage(ev->window, &wa, 0);
+	getprops(ev->window, &props);
+	manage(ev->window, &wa, &props, 0);
+	freeprops(&props);
 }
 
 /* change cursor */
@@ -4497,6 +5729,13 @@ xeventmotionnotify(XEvent *e)
 	struct Winres res;
 	int region;
 
+	/* motion is handled once per event batch, at the last position */
+	if (drag.type != DragNone) {
+		drag.motionx = ev->x_root;
+		drag.motiony = ev->y_root;
+		drag.motion = 1;
+		return;
+	}
 	res = getwin(ev->window);
 	if (res.c == NULL || ev->subwindow != res.c->curswin)
 		return;
@@ -4551,12 +5790,16 @@ xeventpropertynotify(XEvent *e)
 	if (res.t == NULL || ev->window != res.t->win)
 		return;
 	if (ev->atom == XA_WM_NAME || ev->atom == atoms[NetWMName]) {
-		tabupdatetitle(res.t);
-		clientdecorate(res.t->c, 1, 0, FrameNone);
+		/* clients may change their title many times in a row; redraw it only once */
+		if (res.t->titletimer == NULL) {
+			res.t->titletimer = timeradd(TITLEDELAY, 0, tabtitletimeout, res.t);
+		}
 	} else if (ev->atom == XA_WM_CLASS) {
 		tabupdateclass(res.t);
 	} else if (ev->atom == XA_WM_HINTS) {
 		tabupdateurgency(res.t, isurgent(res.t->win));
+	} else if (ev->atom == atoms[NetWMSyncRequestCounter] && res.t->synccounter != None) {
+		tabsyncreset(res.t);
 	}
 }
 
@@ -4567,6 +5810,10 @@ xeventunmapnotify(XEvent *e)
 	XUnmapEvent *ev = &e->xunmap;
 	struct Winres res;
 
+	if (prompt != NULL && ev->window == prompt->win) {
+		promptdel();
+		return;
+	}
 	res = getwin(ev->window);
 	if (res.n && ev->window == res.n->win) {
 		notifdel(res.n);
@@ -4593,10 +5840,153 @@ update:
 	ewmhsetclientsstacking();
 }
 
+/* wait until there are X events to be read, a timer expires, or a signal arrives */
+static void
+waitevents(void)
+{
+	struct pollfd pfd[2];
+	char buf[64];
+
+	if (XPending(dpy))
+		return;
+	pfd[0].fd = ConnectionNumber(dpy);
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sigpipe[0];
+	pfd[1].events = POLLIN;
+	if (poll(pfd, 2, idlepending() ? 0 : timerwait()) == -1) {
+		if (errno == EINTR)
+			return;
+		err(1, "poll");
+	}
+	if (pfd[1].revents & POLLIN) {
+		while (read(sigpipe[0], buf, sizeof buf) > 0)
+			;
+	}
+}
+
+/* get the window an event is about (which is not always the event window) */
+static Window
+eventwindow(XEvent *ev)
+{
+	switch (ev->type) {
+	case ConfigureRequest:
+		return ev->xconfigurerequest.window;
+	case MapRequest:
+		return ev->xmaprequest.window;
+	case DestroyNotify:
+		return ev->xdestroywindow.window;
+	case UnmapNotify:
+		return ev->xunmap.window;
+	default:
+		return ev->xany.window;
+	}
+}
+
+/* merge values of earlier configure request into later one */
+static void
+eventmergeconfigure(XConfigureRequestEvent *old, XConfigureRequestEvent *new)
+{
+	if (!(new->value_mask & CWX))
+		new->x = old->x;
+	if (!(new->value_mask & CWY))
+		new->y = old->y;
+	if (!(new->value_mask & CWWidth))
+		new->width = old->width;
+	if (!(new->value_mask & CWHeight))
+		new->height = old->height;
+	if (!(new->value_mask & CWBorderWidth))
+		new->border_width = old->border_width;
+	if (!(new->value_mask & (CWSibling | CWStackMode))) {
+		new->above = old->above;
+		new->detail = old->detail;
+	}
+	new->value_mask |= old->value_mask;
+}
+
+/* elide events in batch made redundant by batch[n]; elided events get type 0 */
+static void
+eventcoalesce(XEvent *batch, int n)
+{
+	XEvent *new, *old;
+	Window win;
+	int i;
+
+	new = &batch[n];
+	win = eventwindow(new);
+	for (i = n - 1; i >= 0; i--) {
+		old = &batch[i];
+		if (old->type == 0 || eventwindow(old) != win)
+			continue;
+		if (old->type != new->type)     /* another kind of event on the window, stop here */
+			return;
+		switch (new->type) {
+		case MotionNotify:
+			old->type = 0;
+			evstats.motion++;
+			return;
+		case ConfigureRequest:
+			eventmergeconfigure(&old->xconfigurerequest, &new->xconfigurerequest);
+			old->type = 0;
+			evstats.configure++;
+			return;
+		case PropertyNotify:
+			if (old->xproperty.atom == new->xproperty.atom &&
+			    old->xproperty.state == new->xproperty.state) {
+				old->type = 0;
+				evstats.property++;
+				return;
+			}
+			break;
+		case Expose:
+			if (old->xexpose.x >= new->xexpose.x &&
+			    old->xexpose.y >= new->xexpose.y &&
+			    old->xexpose.x + old->xexpose.width <= new->xexpose.x + new->xexpose.width &&
+			    old->xexpose.y + old->xexpose.height <= new->xexpose.y + new->xexpose.height) {
+				old->type = 0;
+				evstats.expose++;
+			}
+			break;
+		default:
+			return;
+		}
+	}
+}
+
+/* read pending events into batch, blocking until there is one; return number of events read */
+static int
+eventbatch(XEvent *batch)
+{
+	int n;
+
+	XNextEvent(dpy, &batch[0]);
+	evstats.read++;
+	for (n = 1; n < EVBATCHSIZ && XPending(dpy); n++) {
+		XNextEvent(dpy, &batch[n]);
+		evstats.read++;
+		eventcoalesce(batch, n);
+	}
+	return n;
+}
+
+/* print event statistics */
+static void
+eventreport(void)
+{
+	warnx("%lu events read, %lu elided (%lu motion, %lu configure, %lu property, %lu expose)",
+	      evstats.read,
+	      evstats.motion + evstats.configure + evstats.property + evstats.expose,
+	      evstats.motion, evstats.configure, evstats.property, evstats.expose);
+}
+
 /* clean clients and other structures */
 static void
 cleanclients(void)
 {
+	struct Colchunk *cchunk;
+	struct Rowchunk *rchunk;
+
+	if (prompt != NULL)
+		promptdel();
 	while (clients) {
 		if (clients->ishidden)
 			clienthide(clients, 0);
@@ -4605,8 +5995,20 @@ cleanclients(void)
 		clientdel(clients);
 	}
 	while (mons) {
-		mondel(mons);
+		mondel(mons, NULL);
 	}
+	while (colchunks) {
+		cchunk = colchunks->next;
+		free(colchunks);
+		colchunks = cchunk;
+	}
+	while (rowchunks) {
+		rchunk = rowchunks->next;
+		free(rowchunks);
+		rowchunks = rchunk;
+	}
+	free(tilecols);
+	free(tiles);
 }
 
 /* destroy dummy windows */
@@ -4668,6 +6070,35 @@ cleanpixmaps(void)
 	}
 }
 
+/* cancel pending timers */
+static void
+cleantimers(void)
+{
+	while (timers) {
+		timerdel(timers);
+	}
+}
+
+/* free tables of window rules */
+static void
+cleanrules(void)
+{
+	struct Ruleent *e, *next;
+	size_t j;
+	int i;
+
+	for (i = 0; i < LAST_PREFIX; i++) {
+		for (j = 0; j < ruletabs[i].size; j++) {
+			for (e = ruletabs[i].buckets[j]; e; e = next) {
+				next = e->next;
+				free(e->key);
+				free(e);
+			}
+		}
+		free(ruletabs[i].buckets);
+	}
+}
+
 /* free fontset */
 static void
 cleanfontset(void)
@@ -4679,9 +6110,10 @@ cleanfontset(void)
 int
 main(int argc, char *argv[])
 {
-	XEvent ev;
+	int i, n;
 	void (*xevents[LASTEvent])(XEvent *) = {
 		[ButtonPress]      = xeventbuttonpress,
+		[ButtonRelease]    = xeventbuttonrelease,
 		[ClientMessage]    = xeventclientmessage,
 		[ConfigureNotify]  = xeventconfigurenotify,
 		[ConfigureRequest] = xeventconfigurerequest,
@@ -4701,6 +6133,8 @@ main(int argc, char *argv[])
 		warnx("warning: no locale support");
 	if ((dpy = XOpenDisplay(NULL)) == NULL)
 		errx(1, "could not open display");
+	xcb = XGetXCBConnection(dpy);
+	hassync = XSyncQueryExtension(dpy, &syncevbase, &syncerrbase) && XSyncInitialize(dpy, &i, &n);
 	screen = DefaultScreen(dpy);
 	screenw = DisplayWidth(dpy, screen);
 	screenh = DisplayHeight(dpy, screen);
@@ -4722,6 +6156,7 @@ main(int argc, char *argv[])
 	initfontset();
 	initcursors();
 	initatoms();
+	initrules();
 	initnotif();
 	initroot();
 
@@ -4744,11 +6179,32 @@ main(int argc, char *argv[])
 	/* scan windows */
 	scan();
 	mapfocuswin();
+	ewmhflush();
 
 	/* run main event loop */
-	while (running && !XNextEvent(dpy, &ev))
-		if (xevents[ev.type])
-			(*xevents[ev.type])(&ev);
+	while (running) {
+		waitevents();
+		if (!running)
+			break;
+		timerrun();
+		if (XPending(dpy)) {
+			n = eventbatch(evbatch);
+			for (i = 0; i < n; i++) {
+				if (hassync && evbatch[i].type == syncevbase + XSyncAlarmNotify) {
+					xeventalarmnotify(&evbatch[i]);
+				} else if (evbatch[i].type > 0 && evbatch[i].type < LASTEvent && xevents[evbatch[i].type]) {
+					(*xevents[evbatch[i].type])(&evbatch[i]);
+				}
+			}
+			dragmotion();
+		}
+		ewmhflush();
+		idlerun();
+		if (reportstats) {
+			eventreport();
+			reportstats = 0;
+		}
+	}
 
 	/* clean up */
 	cleandummywindows();
@@ -4756,11 +6212,14 @@ main(int argc, char *argv[])
 	cleanclients();
 	cleanpixmaps();
 	cleanfontset();
+	cleanrules();
+	cleantimers();
 
 	/* clear ewmh hints */
 	ewmhsetclients();
 	ewmhsetclientsstacking();
 	ewmhsetactivewindow(None);
+	ewmhflush();
 
 	/* close connection to server */
 	XUngrabPointer(dpy, CurrentTime);
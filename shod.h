@@ -1,9 +1,15 @@
 #define INDIRECT_SOURCE 1
 #define IGNOREUNMAP     6       /* number of unmap notifies to ignore while scanning existing clients */
-#define DIV             15      /* number to divide the screen into grids */
 #define DOUBLECLICK     250     /* time in miliseconds of a double click */
+#define TITLEDELAY      50      /* time in miliseconds to wait before redrawing a changed title */
+#define SYNCTIMEOUT     100     /* time in miliseconds to wait for a client to acknowledge a resize */
+#define TILECHUNK       32      /* number of columns or rows allocated at once */
+#define IDLEBUDGET      5       /* time in miliseconds idle jobs can run for at each loop iteration */
 #define NAMEMAXLEN      1024    /* maximum length of window's name */
-#define RULEMINSIZ      23      /* length of "shod.instance..desktop" + 1 for \0 */
+#define RULETABSIZ      64      /* initial number of buckets of each table of window rules */
+#define EVBATCHSIZ      128     /* maximum number of events read and coalesced at once */
+#define WINLISTSIZ      64      /* initial size of the arrays of managed windows */
+#define WINTABSIZ       64      /* initial number of buckets of the window lookup table */
 #define WIDTH(x)  ((x)->w + 2 * (x)->b)
 #define HEIGHT(x) ((x)->h + 2 * (x)->b + (x)->t)
 
@@ -33,6 +39,29 @@ enum {
 	LAST_SUFFIX = 4
 };
 
+/* window properties fetched when managing a window */
+enum {
+	PropWindowType,
+	PropTransientFor,
+	PropNormalHints,
+	PropHints,
+	PropNetWMName,
+	PropWMName,
+	PropClass,
+	PropRole,
+	PropProtocols,
+	PropSyncCounter,
+	PropLast
+};
+
+/* idle job priorities, from highest to lowest */
+enum {
+	IdleProperty,   /* rewrite client window properties */
+	IdleDecoration, /* redraw decoration of hidden clients */
+	IdlePixmap,     /* free pixmaps of hidden clients */
+	IdleLast
+};
+
 /* EWMH window state actions */
 enum {
 	STICK,
@@ -169,12 +198,22 @@ enum {
 	NetWMStateAttention,
 	NetFrameExtents,
 	NetDesktopViewport,
+	NetWMSyncRequest,
+	NetWMSyncRequestCounter,
 
 	ShodTabGroup,
 
 	AtomLast
 };
 
+/* root window properties to be published at the end of an event batch */
+enum {
+	DirtyClientList         = (1 << 0),
+	DirtyClientListStacking = (1 << 1),
+	DirtyActiveWindow       = (1 << 2),
+	DirtyCurrentDesktop     = (1 << 3),
+};
+
 /* window layers */
 enum {
 	LayerDesktop,
@@ -203,15 +242,6 @@ enum {
 	CURSOR_LAST
 };
 
-/* frame region */
-enum {
-	FrameNone = 0,
-	FrameButtonLeft = 1,
-	FrameButtonRight = 2,
-	FrameTitle = 3,
-	FrameBorder = 4,
-};
-
 /* auto-tab behavior */
 enum {
 	NoAutoTab,
@@ -227,17 +257,20 @@ enum {
 	UpWards
 };
 
-/* window eight sections (aka octants) */
-enum Octant {
-	C  = 0,
-	N  = (1 << 0),
-	S  = (1 << 1),
-	W  = (1 << 2),
-	E  = (1 << 3),
-	NW = (1 << 0) | (1 << 2),
-	NE = (1 << 0) | (1 << 3),
-	SW = (1 << 1) | (1 << 2),
-	SE = (1 << 1) | (1 << 3),
+/* timer, runs a function after some time has elapsed */
+struct Timer {
+	struct Timer *next;
+	void (*fn)(void *);
+	void *arg;
+	long long when;         /* time in miliseconds when the timer expires */
+	long period;            /* time in miliseconds between runs, 0 for one-shot timers */
+};
+
+/* idle job, runs a function when there are no events to be handled */
+struct Idle {
+	struct Idle *next;
+	void (*fn)(void *);
+	void *arg;
 };
 
 /* transient window structure */
@@ -250,12 +283,14 @@ struct Transient {
 	int x, y, w, h;
 	int maxw, maxh;
 	int pw, ph;
+	int nx, ny, nw, nh;     /* geometry sent in the last synthetic ConfigureNotify */
 	int ignoreunmap;
 };
 
-/* prompt structure, used only when calling promptisvalid() */
+/* prompt structure, there is at most one prompt at a time */
 struct Prompt {
 	Window win, frame;
+	int w, h;               /* size of the prompt window */
 };
 
 /* tab structure */
@@ -269,18 +304,27 @@ struct Tab {
 	Pixmap pix;
 	char *name;
 	char *class;
+	struct Timer *titletimer;       /* pending title update */
+	XSyncCounter synccounter;       /* counter the client updates after handling a resize */
+	long long syncvalue;            /* value of the last sync request sent to the client */
 	int ignoreunmap;
 	int isurgent;
+	int ishidden;           /* whether the tab is unmapped behind the selected one */
 	int winw, winh;         /* window geometry */
 	int x, w;               /* tab geometry */
 	int pw;                 /* pixmap width */
+	int nx, ny, nw, nh;     /* geometry sent in the last synthetic ConfigureNotify */
 };
 
 /* client structure */
 struct Client {
 	struct Client *prev, *next;
-	struct Client *fprev, *fnext;
-	struct Client *rprev, *rnext;
+	struct Client *fprev, *fnext;   /* neighbours in the focus history */
+	struct Client **fhead;          /* focus history the client is in */
+	unsigned long fseq;             /* value of focusseq when the client was last focused */
+	struct Client *dprev, *dnext;   /* neighbours in the member list of its desktop or monitor */
+	struct Client **dhead;          /* member list the client is in */
+	struct Client *sprev, *snext;   /* neighbours in the stacking list of its layer */
 	struct Monitor *mon;
 	struct Desktop *desk;
 	struct Row *row;
@@ -288,14 +332,18 @@ struct Client {
 	struct Tab *seltab;
 	int ntabs;
 	int ishidden, isuserplaced, isshaded, isfullscreen;
+	int isparked;           /* whether the frame is mapped off screen while its desktop is hidden */
 	int state;
 	int saveh;              /* original height, used for shading */
 	int rh;                 /* row height */
 	int x, y, w, h, b, t;   /* current geometry */
+	int cx, cy, cw, ch, cb, ct;     /* geometry last committed to the frame */
 	int pw, ph;             /* pixmap width and height */
 	int fx, fy, fw, fh;     /* floating geometry */
 	int tx, ty, tw, th;     /* tiled geometry */
 	int layer;              /* stacking order */
+	int slayer;             /* layer whose stacking list the client is in */
+	unsigned long sseq;     /* value of stackseq when the client was put on top of its layer */
 	long shflags;
 	Window curswin;
 	Window frame;
@@ -315,13 +363,28 @@ struct Column {
 	struct Column *prev, *next;
 	struct Desktop *desk;
 	struct Row *row;
+	struct Row *lastrow;
 	int w;          /* column width */
 };
 
+/* columns and rows are allocated in chunks, to keep them close in memory */
+struct Colchunk {
+	struct Colchunk *next;
+	struct Column cols[TILECHUNK];
+};
+
+struct Rowchunk {
+	struct Rowchunk *next;
+	struct Row rows[TILECHUNK];
+};
+
 /* desktop of a monitor */
 struct Desktop {
 	struct Monitor *mon;
 	struct Column *col;
+	struct Column *lastcol;
+	struct Client *clients; /* its normal and tiled clients */
+	struct Client *focus;   /* focus history of its normal and tiled clients */
 	int n;                  /* desktop number */
 };
 
@@ -330,6 +393,8 @@ struct Monitor {
 	struct Monitor *prev, *next;
 	struct Desktop *desks;
 	struct Desktop *seldesk;
+	struct Client *sticky;  /* its sticky clients */
+	struct Client *stickyfocus;     /* focus history of its sticky clients */
 	int mx, my, mw, mh;     /* screen size */
 	int wx, wy, ww, wh;     /* window area */
 	int gx, gy, gw, gh;     /* window area with gaps */
@@ -351,6 +416,8 @@ struct Config {
 
 	int ignoreindirect;
 
+	int parkdesktops;
+
 	int gapinner;
 	int gapouter;
 
@@ -358,6 +425,9 @@ struct Config {
 
 	int notifgap;
 
+	int liveresize;
+	int resizerate;
+
 	unsigned int modifier;
 	unsigned int focusbuttons;
 	unsigned int raisebuttons;
@@ -402,12 +472,90 @@ struct Winres {
 	struct Transient *trans;
 };
 
+/* entry of the window lookup table, maps a window to the structure it belongs to */
+struct Winmap {
+	struct Winmap *next;
+	struct Notification *n;
+	struct Client *c;
+	struct Tab *t;
+	struct Transient *trans;
+	Window win;
+};
+
+/* array of managed windows published in a root window property */
+struct Winlist {
+	Window *wins;
+	struct Client **owners; /* client each window belongs to */
+	size_t nwins;           /* number of windows in the array */
+	size_t maxwins;         /* number of windows allocated */
+	size_t npublished;      /* number of windows already published in the property */
+	int rewrite;            /* whether the property must be rewritten rather than appended to */
+};
+
+/* counters of events read and elided by the event coalescing stage */
+struct Evstats {
+	unsigned long read;
+	unsigned long motion;
+	unsigned long configure;
+	unsigned long property;
+	unsigned long expose;
+};
+
 /* rectangle */
 struct Outline {
 	int x, y, w, h;
 	int diffx, diffy;
 };
 
+/* interactive operation performed with the mouse */
+enum DragType {
+	DragNone,
+	DragButton,     /* pressing a title bar button */
+	DragRetab,      /* moving a detached tab */
+	DragMove,       /* moving a frame */
+	DragResize      /* resizing a frame */
+};
+
+/* state of the interactive operation being performed with the mouse */
+struct Drag {
+	enum DragType type;
+	struct Client *c;       /* client being operated on */
+	struct Tab *t;          /* tab being operated on, if any */
+	struct Outline outline; /* outline of the client being resized */
+	enum Octant octant;     /* border being dragged */
+	int region;             /* frame region being pressed */
+	int xroot, yroot;       /* pointer position at last handled motion */
+	int x, y;               /* pointer position relative to the tab or to the border */
+	int motionx, motiony;   /* pointer position at last motion event */
+	int motion;             /* whether there is a motion event not yet handled */
+
+	/* live resizing */
+	int live;               /* whether to resize while dragging, rather than drawing an outline */
+	int startw, starth;     /* size of the client (or of its column and row) when the resize started */
+	int syncwaiting;        /* whether waiting for the client to acknowledge the last resize */
+	long long lastresize;   /* time of the last resize */
+	struct Timer *resizetimer;      /* pending resize, or timeout for the acknowledgement */
+	XSyncAlarm alarm;       /* alarm triggered when the client acknowledges a resize */
+};
+
+/* properties of a window being managed */
+struct Winprops {
+	Atom type;              /* first atom of _NET_WM_WINDOW_TYPE */
+	Window transfor;        /* WM_TRANSIENT_FOR */
+	char *name;             /* _NET_WM_NAME, or WM_NAME */
+	char *instance;         /* first string of WM_CLASS */
+	char *class;            /* second string of WM_CLASS */
+	char *role;             /* WM_WINDOW_ROLE */
+	int isuserplaced;       /* whether WM_NORMAL_HINTS has USPosition */
+	int isurgent;           /* whether WM_HINTS has UrgencyHint */
+	XSyncCounter synccounter;       /* _NET_WM_SYNC_REQUEST_COUNTER, if WM_PROTOCOLS has _NET_WM_SYNC_REQUEST */
+};
+
+/* pending requests for the properties of a window being managed */
+struct Propcookies {
+	xcb_get_property_cookie_t cookies[PropLast];
+};
+
 /* window rules read from X resources */
 struct Rules {
 	int desk;
@@ -416,6 +564,20 @@ struct Rules {
 	int x, y, w, h;
 };
 
+/* entry of a table of window rules, maps a title, instance, class or role to its rules */
+struct Ruleent {
+	struct Ruleent *next;
+	char *key;
+	struct Rules rules;
+};
+
+/* table of window rules for one of the role prefixes */
+struct Ruletab {
+	struct Ruleent **buckets;
+	size_t size;            /* number of buckets, always a power of two */
+	size_t count;           /* number of entries */
+};
+
 /* notification window */
 struct Notification {
 	struct Notification *prev, *next;